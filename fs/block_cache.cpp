@@ -0,0 +1,300 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <fs/block_cache.hpp>
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+namespace fs {
+
+// 2Q tuning: share of the capacity for blocks seen once,
+// and how many evicted blocks to remember, relative to capacity
+static const size_t PROBATION_SHARE = 4;  // 1/4
+static const size_t GHOST_FACTOR    = 2;  // 1/2 of capacity, in entries
+
+BlockCache::BlockCache(hw::IDiskDevice& dev, size_t capacity,
+                       policy_t policy, size_t shards_)
+  : device       { dev },
+    max_bytes    { capacity },
+    cache_policy { policy },
+    shard_count  { shards_ ? shards_ : 1 },
+    shards       { new Shard[shard_count] }
+{
+  for (size_t i = 0; i < shard_count; i++)
+  {
+    shards[i].max_bytes   = max_bytes / shard_count;
+    shards[i].policy      = cache_policy;
+  }
+}
+
+void BlockCache::read(block_t blk, on_read_func reader) {
+  read(blk, 1, std::move(reader));
+}
+
+void BlockCache::read(block_t blk, block_t count, on_read_func reader) {
+  // longer ranges are bulk data, which would only push out metadata
+  if (count > max_entry_blocks)
+  {
+    device.read(blk, count, reader); return;
+  }
+  
+  auto data = lookup(blk, count);
+  if (data)
+  {
+    reader(data); return;
+  }
+  
+  device.read(blk, count,
+  [this, blk, count, reader] (buffer_t data)
+  {
+    if (data) insert(blk, count, data);
+    reader(data);
+  });
+}
+
+BlockCache::buffer_t BlockCache::read_sync(block_t blk)
+{
+  return read_sync(blk, 1);
+}
+
+BlockCache::buffer_t BlockCache::read_sync(block_t blk, block_t count)
+{
+  if (count > max_entry_blocks)
+      return device.read_sync(blk, count);
+  
+  auto data = lookup(blk, count);
+  if (likely(data)) return data;
+  
+  data = device.read_sync(blk, count);
+  if (data) insert(blk, count, data);
+  return data;
+}
+
+void BlockCache::prefetch(block_t blk, block_t count)
+{
+  if (count == 0 || contains(blk, count))
+      return;
+  
+  // reading here would block on synchronous devices, so only pass
+  // the hint on and let the device fetch in the background
+  device.prefetch(blk, count);
+}
+
+void BlockCache::clear()
+{
+  for (size_t i = 0; i < shard_count; i++)
+  {
+    std::lock_guard<std::mutex> lock(shards[i].mtx);
+    shards[i].clear();
+  }
+}
+
+size_t BlockCache::used() const
+{
+  size_t total = 0;
+  for (size_t i = 0; i < shard_count; i++)
+  {
+    std::lock_guard<std::mutex> lock(shards[i].mtx);
+    total += shards[i].used();
+  }
+  return total;
+}
+
+BlockCache::Stats BlockCache::stats() const
+{
+  Stats total {};
+  for (size_t i = 0; i < shard_count; i++)
+  {
+    std::lock_guard<std::mutex> lock(shards[i].mtx);
+    total.hits_new     += shards[i].stats.hits_new;
+    total.hits_hot     += shards[i].stats.hits_hot;
+    total.misses_ghost += shards[i].stats.misses_ghost;
+    total.misses_cold  += shards[i].stats.misses_cold;
+  }
+  return total;
+}
+
+BlockCache::buffer_t BlockCache::lookup(block_t blk, block_t count)
+{
+  auto& sh = shard(blk);
+  std::lock_guard<std::mutex> lock(sh.mtx);
+  return sh.lookup(blk, count);
+}
+
+bool BlockCache::contains(block_t blk, block_t count)
+{
+  auto& sh = shard(blk);
+  std::lock_guard<std::mutex> lock(sh.mtx);
+  auto it = sh.index.find(blk);
+  return it != sh.index.end() && it->second.count >= count;
+}
+
+void BlockCache::insert(block_t blk, block_t count, buffer_t data)
+{
+  auto& sh = shard(blk);
+  std::lock_guard<std::mutex> lock(sh.mtx);
+  sh.insert(blk, count, std::move(data));
+}
+
+void BlockCache::Shard::clear()
+{
+  index.clear();
+  main = Queue<Entry>();
+  probation = Queue<Entry>();
+  ghosts.clear();
+  ghost_queue = Queue<Ghost>();
+}
+
+BlockCache::buffer_t BlockCache::Shard::lookup(block_t blk, block_t count)
+{
+  auto it = index.find(blk);
+  if (it == index.end() || it->second.count < count)
+  {
+    if (ghosts.count(blk))
+        stats.misses_ghost++;
+    else
+        stats.misses_cold++;
+    return buffer_t();
+  }
+  
+  auto& entry = it->second;
+  if (entry.hot)
+  {
+    // move to front of LRU queue
+    stats.hits_hot++;
+    main.unlink(entry);
+    main.push_front(entry);
+  }
+  else
+  {
+    // the probation queue is FIFO, hits don't reorder it
+    stats.hits_new++;
+  }
+  if (entry.count == count) return entry.data;
+  return entry.data.slice(0, entry.data.size() / entry.count * count);
+}
+
+void BlockCache::Shard::insert(block_t blk, block_t count, buffer_t data)
+{
+  // accounted as read, the block size is up to the device and its image
+  const size_t bytes = data.size();
+  if (unlikely(bytes > max_bytes)) return;
+  
+  // a longer range replaces a shorter one from the same block,
+  // and keeps its place in the main queue
+  bool was_hot = false;
+  auto it = index.find(blk);
+  if (it != index.end())
+  {
+    // another reader could have cached the range first
+    if (it->second.count >= count) return;
+    was_hot = it->second.hot;
+    evict(it->second);
+  }
+  
+  make_room(bytes);
+  
+  // with LRU everything goes into the main queue, with 2Q only
+  // blocks that were evicted recently, which are read again
+  bool hot = true;
+  if (policy == TWO_QUEUE && !was_hot)
+  {
+    auto it = ghosts.find(blk);
+    hot = (it != ghosts.end());
+    if (hot)
+    {
+      ghost_queue.unlink(it->second);
+      ghosts.erase(it);
+    }
+  }
+  
+  auto& entry = index.emplace(blk, Entry{blk, count, std::move(data), hot, nullptr, nullptr}).first->second;
+  auto& queue = hot ? main : probation;
+  queue.push_front(entry);
+  queue.bytes += bytes;
+}
+
+void BlockCache::Shard::make_room(size_t bytes)
+{
+  const size_t probation_max = max_bytes / PROBATION_SHARE;
+  
+  while (used() + bytes > max_bytes)
+  {
+    // 2Q: keep the probation queue at its share of the cache
+    if (probation.tail && (probation.bytes > probation_max || !main.tail))
+    {
+      auto& victim = *probation.tail;
+      remember(victim.block, victim.data.size());
+      evict(victim);
+    }
+    else
+    {
+      evict(*main.tail);
+    }
+  }
+}
+
+void BlockCache::Shard::evict(Entry& entry)
+{
+  auto& queue = entry.hot ? main : probation;
+  queue.unlink(entry);
+  queue.bytes -= entry.data.size();
+  index.erase(entry.block);
+}
+
+void BlockCache::Shard::remember(block_t blk, size_t bytes)
+{
+  // as many as entries of this size would fill the share
+  const size_t ghost_max = max_bytes / bytes / GHOST_FACTOR;
+  
+  while (ghosts.size() >= ghost_max && ghost_queue.tail)
+  {
+    auto& oldest = *ghost_queue.tail;
+    ghost_queue.unlink(oldest);
+    ghosts.erase(oldest.block);
+  }
+  if (unlikely(ghost_max == 0)) return;
+  
+  auto& ghost = ghosts.emplace(blk, Ghost{blk, nullptr, nullptr}).first->second;
+  ghost_queue.push_front(ghost);
+}
+
+template <typename T>
+void BlockCache::Queue<T>::unlink(T& elem)
+{
+  if (elem.prev) elem.prev->next = elem.next;
+  else head = elem.next;
+  
+  if (elem.next) elem.next->prev = elem.prev;
+  else tail = elem.prev;
+  
+  elem.prev = elem.next = nullptr;
+}
+
+template <typename T>
+void BlockCache::Queue<T>::push_front(T& elem)
+{
+  elem.prev = nullptr;
+  elem.next = head;
+  if (head) head->prev = &elem;
+  head = &elem;
+  if (!tail) tail = &elem;
+}
+
+} //< namespace fs
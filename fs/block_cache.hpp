@@ -0,0 +1,195 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+#ifndef FS_BLOCK_CACHE_HPP
+#define FS_BLOCK_CACHE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <hw/disk_device.hpp>
+
+namespace fs {
+
+/**
+ *  Block cache in front of any disk device
+ *  
+ *  Blocks are found through a hash index, and replaced according
+ *  to the cache policy once the cache holds more than its capacity
+ *  in bytes:
+ *  
+ *  LRU:       least-recently-used block is evicted first
+ *  TWO_QUEUE: blocks seen once wait in a small FIFO queue and only
+ *             enter the main LRU queue when they are read again
+ *             shortly after being evicted, so a single pass over a
+ *             large file does not push out the metadata working set
+ *  
+ *  Reads of up to max_entry() blocks are cached as one entry, found
+ *  by their first block, so a filesystem reading whole clusters gets
+ *  one entry per cluster. A read is served from an entry starting at
+ *  the same block holding at least as many blocks. Longer ranges are
+ *  bulk data and pass through.
+ *  
+ *  The cache is safe to use from several threads. Blocks are spread
+ *  over independently locked shards, each with its own share of the
+ *  capacity, and the device is read without holding any lock.
+**/
+class BlockCache : public hw::IDiskDevice {
+public:
+  enum policy_t {
+    LRU,
+    TWO_QUEUE
+  };
+  
+  /** Hit and miss counters, by where the block was found */
+  struct Stats {
+    uint64_t hits_new;     //< hits on blocks seen once (2Q only)
+    uint64_t hits_hot;     //< hits on blocks in the main LRU queue
+    uint64_t misses_ghost; //< misses on recently evicted blocks (2Q only)
+    uint64_t misses_cold;  //< misses on blocks not seen recently
+  };
+  
+  static constexpr size_t  DEFAULT_SHARDS    = 8;
+  static constexpr block_t DEFAULT_MAX_ENTRY = 128;
+  
+  /** Cache blocks read from @dev, using at most @capacity bytes */
+  BlockCache(hw::IDiskDevice& dev, size_t capacity,
+             policy_t policy = LRU, size_t shards = DEFAULT_SHARDS);
+  
+  virtual const char* name() const noexcept override
+  { return "BlockCache"; }
+  
+  virtual block_t size() const noexcept override
+  { return device.size(); }
+  
+  virtual block_t block_size() const noexcept override
+  { return device.block_size(); }
+  
+  virtual void read(block_t blk, on_read_func reader) override;
+  virtual void read(block_t blk, block_t count, on_read_func reader) override;
+  
+  virtual buffer_t read_sync(block_t blk) override;
+  virtual buffer_t read_sync(block_t blk, block_t count) override;
+  
+  /** Pass the hint on to the device, unless the range is cached */
+  virtual void prefetch(block_t blk, block_t count) override;
+  
+  /** Drop every cached block */
+  void clear();
+  
+  policy_t policy() const noexcept
+  { return cache_policy; }
+  
+  /** Longest range, in blocks, cached as one entry. Set before use */
+  block_t max_entry() const noexcept
+  { return max_entry_blocks; }
+  void set_max_entry(block_t blocks) noexcept
+  { max_entry_blocks = blocks ? blocks : 1; }
+  
+  /** Maximum and current number of bytes cached */
+  size_t capacity() const noexcept
+  { return max_bytes; }
+  size_t used() const;
+  
+  Stats stats() const;
+  
+  /** Lookups served from and missing the cache */
+  uint64_t hits() const
+  { auto st = stats(); return st.hits_new + st.hits_hot; }
+  uint64_t misses() const
+  { auto st = stats(); return st.misses_ghost + st.misses_cold; }
+  
+private:
+  struct Entry {
+    block_t  block;
+    block_t  count;
+    buffer_t data;
+    bool     hot;  //< in the main queue
+    // intrusive queue, head is most recently inserted/used
+    Entry*   prev;
+    Entry*   next;
+  };
+  struct Ghost {
+    block_t  block;
+    Ghost*   prev;
+    Ghost*   next;
+  };
+  
+  template <typename T>
+  struct Queue {
+    T*     head  = nullptr;
+    T*     tail  = nullptr;
+    size_t bytes = 0;
+    
+    void unlink(T&);
+    void push_front(T&);
+  };
+  
+  /** Part of the cache with its own lock, capacity and queues */
+  struct Shard {
+    // returns @count cached blocks from @blk, or nullptr
+    buffer_t lookup(block_t blk, block_t count);
+    // caches @data as @count blocks from @blk
+    void insert(block_t blk, block_t count, buffer_t data);
+    void clear();
+    
+    size_t used() const noexcept
+    { return main.bytes + probation.bytes; }
+    
+    // evicts blocks until @bytes more fit in the shard
+    void make_room(size_t bytes);
+    void evict(Entry&);
+    void remember(block_t blk, size_t bytes);
+    
+    std::mutex mtx;
+    size_t   max_bytes;
+    policy_t policy;
+    Stats    stats {};
+    
+    // entries keep their address when the index grows
+    std::unordered_map<block_t, Entry> index;
+    Queue<Entry> main;      //< LRU order
+    Queue<Entry> probation; //< FIFO order, 2Q only
+    
+    // blocks recently evicted from probation, 2Q only
+    std::unordered_map<block_t, Ghost> ghosts;
+    Queue<Ghost> ghost_queue;
+  };
+  
+  Shard& shard(block_t blk) noexcept
+  { return shards[(blk ^ (blk >> 16)) % shard_count]; }
+  
+  buffer_t lookup(block_t blk, block_t count);
+  void insert(block_t blk, block_t count, buffer_t data);
+  // true if @count blocks from @blk are cached, without counting as a lookup
+  bool contains(block_t blk, block_t count);
+  
+  hw::IDiskDevice& device;
+  const size_t   max_bytes;
+  const policy_t cache_policy;
+  const size_t   shard_count;
+  block_t        max_entry_blocks = DEFAULT_MAX_ENTRY;
+  std::unique_ptr<Shard[]> shards;
+}; //< class BlockCache
+
+} //< namespace fs
+
+#endif //< FS_BLOCK_CACHE_HPP
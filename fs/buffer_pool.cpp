@@ -0,0 +1,175 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fs/buffer_pool.hpp>
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace fs {
+
+// room in front of the data for the shared_ptr control block
+static const size_t HEADER_ROOM = 64;
+
+static_assert(BufferPool::SMALLEST << (BufferPool::CLASSES-1) == BufferPool::LARGE_MAX,
+              "size classes must go from SMALLEST to LARGE_MAX");
+
+struct BufferPool::Impl
+{
+  struct free_list
+  {
+    std::mutex mtx;
+    std::vector<void*> chunks;
+  };
+  
+  Impl(size_t max)
+    : max_free(max) {}
+  
+  ~Impl()
+  {
+    for (auto& fl : lists)
+    for (void* chunk : fl.chunks)
+        ::operator delete(chunk);
+  }
+  
+  static size_t class_size(int cls)
+  {
+    return SMALLEST << cls;
+  }
+  // the smallest class that holds @bytes, -1 if none
+  static int class_of(size_t bytes)
+  {
+    int cls = 0;
+    while (class_size(cls) < bytes)
+      if (++cls == (int) CLASSES) return -1;
+    return cls;
+  }
+  
+  void* pop(int cls)
+  {
+    auto& fl = lists[cls];
+    {
+      std::lock_guard<std::mutex> lock(fl.mtx);
+      if (!fl.chunks.empty())
+      {
+        void* chunk = fl.chunks.back();
+        fl.chunks.pop_back();
+        return chunk;
+      }
+    }
+    return ::operator new(HEADER_ROOM + class_size(cls));
+  }
+  void push(int cls, void* chunk)
+  {
+    auto& fl = lists[cls];
+    {
+      std::lock_guard<std::mutex> lock(fl.mtx);
+      if ((fl.chunks.size() + 1) * class_size(cls) <= max_free)
+      {
+        fl.chunks.push_back(chunk);
+        return;
+      }
+    }
+    ::operator delete(chunk);
+  }
+  
+  const size_t max_free;
+  free_list lists[CLASSES];
+};
+
+// allocator placing the control block of a buffer in the front
+// of a pooled chunk, with the data right after it
+template <typename T>
+struct BufferPool::Alloc
+{
+  typedef T value_type;
+  
+  Alloc(std::shared_ptr<Impl> i, int c, uint8_t** d)
+    : impl(std::move(i)), cls(c), data(d) {}
+  template <typename U>
+  Alloc(const Alloc<U>& other)
+    : impl(other.impl), cls(other.cls), data(other.data) {}
+  
+  T* allocate(size_t n)
+  {
+    const size_t bytes = n * sizeof(T);
+    uint8_t* chunk;
+    if (bytes <= HEADER_ROOM)
+    {
+      chunk = (uint8_t*) impl->pop(cls);
+      *data = chunk + HEADER_ROOM;
+    }
+    else
+    {
+      // unusually large control block, don't pool it
+      const size_t header = (bytes + 15) & ~size_t(15);
+      chunk = (uint8_t*) ::operator new(header + Impl::class_size(cls));
+      *data = chunk + header;
+    }
+    return (T*) chunk;
+  }
+  void deallocate(T* p, size_t n)
+  {
+    if (n * sizeof(T) <= HEADER_ROOM)
+        impl->push(cls, p);
+    else
+        ::operator delete(p);
+  }
+  
+  template <typename U>
+  bool operator== (const Alloc<U>& other) const
+  { return impl == other.impl && cls == other.cls; }
+  template <typename U>
+  bool operator!= (const Alloc<U>& other) const
+  { return !(*this == other); }
+  
+  std::shared_ptr<Impl> impl;
+  int       cls;
+  uint8_t** data; //< where to put the data, while allocating
+};
+
+BufferPool::BufferPool(size_t max_free)
+  : impl(std::make_shared<Impl> (max_free)) {}
+
+buffer_t BufferPool::get(size_t bytes)
+{
+  int cls = Impl::class_of(bytes);
+  if (cls < 0)
+  {
+    return buffer_t(new uint8_t[bytes], std::default_delete<uint8_t[]>(), bytes);
+  }
+  
+  uint8_t* data = nullptr;
+  auto owner = std::allocate_shared<uint8_t> (Alloc<uint8_t>(impl, cls, &data));
+  return buffer_t(std::move(owner), data, bytes);
+}
+
+size_t BufferPool::free_bytes() const
+{
+  size_t total = 0;
+  for (size_t cls = 0; cls < CLASSES; cls++)
+  {
+    auto& fl = impl->lists[cls];
+    std::lock_guard<std::mutex> lock(fl.mtx);
+    total += fl.chunks.size() * Impl::class_size(cls);
+  }
+  return total;
+}
+
+} //< namespace fs
+
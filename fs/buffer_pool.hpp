@@ -0,0 +1,69 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef FS_BUFFER_POOL_HPP
+#define FS_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "common.hpp"
+
+namespace fs {
+
+/**
+ *  Recycling pool for sector and file buffers
+ *  
+ *  Buffers come in power-of-two size classes, from one sector up to
+ *  LARGE_MAX bytes. Each buffer is a single allocation holding both
+ *  the data and its reference count, and when the last reference is
+ *  dropped the memory goes back on the free list of its class instead
+ *  of to the heap, so a steady stream of reads does not touch malloc.
+ *  Larger requests are plain heap buffers.
+ *  
+ *  Buffers may outlive the pool, and the pool is safe to use from
+ *  several threads.
+**/
+class BufferPool {
+public:
+  static constexpr size_t SMALLEST  = 512;         //< one sector
+  static constexpr size_t LARGE_MAX = 1024 * 1024; //< largest pooled buffer
+  static constexpr size_t CLASSES   = 12;          //< SMALLEST to LARGE_MAX
+  
+  /** Free memory kept for reuse, per size class */
+  static constexpr size_t DEFAULT_FREE = 1024 * 1024;
+  
+  explicit BufferPool(size_t max_free = DEFAULT_FREE);
+  
+  /** Returns an uninitialized buffer of @bytes */
+  buffer_t get(size_t bytes);
+  
+  /** Bytes waiting on the free lists */
+  size_t free_bytes() const;
+  
+private:
+  struct Impl;
+  template <typename T> struct Alloc;
+  
+  std::shared_ptr<Impl> impl;
+}; //< class BufferPool
+
+} //< namespace fs
+
+#endif //< FS_BUFFER_POOL_HPP
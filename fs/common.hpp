@@ -20,10 +20,11 @@
 #define FS_COMMON_HPP
 
 #include <memory>
+#include <hw/slice.hpp>
 
 namespace fs {
 
-typedef std::shared_ptr<uint8_t> buffer_t;
+typedef hw::Slice buffer_t;
 
 // TODO: transform this into a class with a bool operator
 using error_t = bool;
@@ -0,0 +1,83 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <fs/dcache.hpp>
+
+namespace fs {
+
+DentryCache::DentryCache(size_t max_ents)
+  : max_entries { max_ents ? max_ents : 1 }
+{}
+
+bool DentryCache::lookup(uint64_t parent, const std::string& name, Dirent& ent)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  
+  auto it = index.find(Key{parent, name});
+  if (it == index.end())
+  {
+    stat_misses++;
+    return false;
+  }
+  stat_hits++;
+  
+  // move to front of LRU list
+  lru.splice(lru.begin(), lru, it->second);
+  ent = it->second->second;
+  return true;
+}
+
+void DentryCache::insert(uint64_t parent, const std::string& name, const Dirent& ent)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  
+  Key key {parent, name};
+  auto it = index.find(key);
+  if (it != index.end())
+  {
+    // replace existing entry
+    it->second->second = ent;
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+  
+  // make room if needed
+  while (index.size() >= max_entries)
+  {
+    index.erase(lru.back().first);
+    lru.pop_back();
+  }
+  
+  lru.emplace_front(key, ent);
+  index.emplace(std::move(key), lru.begin());
+}
+
+void DentryCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  index.clear();
+  lru.clear();
+}
+
+size_t DentryCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return index.size();
+}
+
+} //< namespace fs
@@ -0,0 +1,94 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+#ifndef FS_DCACHE_HPP
+#define FS_DCACHE_HPP
+
+#include "filesystem.hpp"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fs {
+
+/**
+ *  Directory entry cache
+ *  
+ *  Maps (parent directory block, name) to the directory entry
+ *  found there. Names that were looked up and not found are kept
+ *  as negative entries, so misses are remembered too. The least
+ *  recently used entries are dropped once the cache is full.
+**/
+class DentryCache {
+public:
+  using Dirent = FileSystem::Dirent;
+  
+  static constexpr size_t DEFAULT_ENTRIES = 4096;
+  
+  explicit DentryCache(size_t max_entries = DEFAULT_ENTRIES);
+  
+  /**
+   *  Returns true if @name in @parent is cached, and sets @ent
+   *  @ent is invalid (!is_valid()) for negative entries
+   */
+  bool lookup(uint64_t parent, const std::string& name, Dirent& ent);
+  
+  /** Cache @ent as @name in @parent, or a negative entry if invalid */
+  void insert(uint64_t parent, const std::string& name, const Dirent& ent);
+  
+  /** Drop every cached entry */
+  void clear();
+  
+  size_t size() const;
+  
+  uint64_t hits() const
+  { std::lock_guard<std::mutex> lock(mtx); return stat_hits; }
+  uint64_t misses() const
+  { std::lock_guard<std::mutex> lock(mtx); return stat_misses; }
+  
+private:
+  struct Key {
+    uint64_t    parent;
+    std::string name;
+    
+    bool operator== (const Key& other) const noexcept
+    { return parent == other.parent && name == other.name; }
+  };
+  struct KeyHash {
+    size_t operator() (const Key& key) const noexcept
+    { return std::hash<std::string>{}(key.name) ^ (key.parent * 0x9E3779B97F4A7C15ull); }
+  };
+  
+  using lru_list = std::list<std::pair<Key, Dirent>>;
+  
+  const size_t max_entries;
+  uint64_t stat_hits   = 0;
+  uint64_t stat_misses = 0;
+  
+  mutable std::mutex mtx;
+  // front is most recently used
+  lru_list lru;
+  std::unordered_map<Key, lru_list::iterator, KeyHash> index;
+}; //< class DentryCache
+
+} //< namespace fs
+
+#endif //< FS_DCACHE_HPP
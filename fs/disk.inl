@@ -67,9 +67,13 @@ Disk<FS>::mount(on_mount_func func)
     auto* mbr = (MBR::mbr*) data.get();
     MBR::BPB* bpb = mbr->bpb();
     
+    // FAT32 keeps the signature after its extended fields
+    const uint8_t signature = (bpb->sectors_per_fat == 0)
+        ? mbr->bpb32()->signature : bpb->signature;
+    
     if (bpb->bytes_per_sector >= 512 
      && bpb->fa_tables != 0 
-     && bpb->signature != 0) // check MBR signature too
+     && signature != 0) // check MBR signature too
     {
       // we have FAT on MBR (and we are assuming mount FAT)
       mount(MBR, func);
@@ -47,6 +47,12 @@ namespace fs
     (void) path;
   }
   
+  FileSystem::cursor_t EXT4::begin(const std::string& path)
+  {
+    (void) path;
+    return nullptr;
+  }
+  
   void EXT4::readFile(const Dirent&, on_read_func callback)
   {
     callback(true, buffer_t(), 0);
@@ -51,6 +51,7 @@ namespace fs
     // path is a path in the mounted filesystem
     virtual void    ls(const std::string& path, on_ls_func) override;
     virtual error_t ls(const std::string& path, dirvec_t e) override;
+    virtual cursor_t begin(const std::string& path) override;
     
     // read an entire file into a buffer, then call on_read
     virtual void readFile(const std::string&, on_read_func) override;
@@ -9,6 +9,7 @@
 #include <cstring>
 #include <memory>
 #include <locale>
+#include <algorithm>
 #include <kernel/syscalls.hpp> // for panic()
 
 #include <info>
@@ -25,25 +26,38 @@ inline std::string trim_right_copy(
 
 namespace fs
 {
+  // passed by reference to std::min, so they need a definition
+  const uint32_t FAT::READ_MAX_SECTORS;
+  const uint32_t FAT::DIR_PREFETCH_MAX;
+  
   FAT::FAT(hw::IDiskDevice& dev)
     : device(dev)
   {
     
   }
   
-  void FAT::init(const void* base_sector)
+  error_t FAT::init(const void* base_sector)
   {
     // assume its the master boot record for now
     auto* mbr = (MBR::mbr*) base_sector;
     
     MBR::BPB* bpb = mbr->bpb();
     this->sector_size = bpb->bytes_per_sector;
-    if (unlikely(this->sector_size < 512))
+    if (unlikely(this->sector_size < 512 || this->sector_size > 4096
+              || (this->sector_size & (this->sector_size - 1))))
     {
       printf("Invalid sector size (%u) for FAT32 partition\n", sector_size);
       printf("Are you mounting the correct partition?\n");
       panic("FAT32: Invalid sector size");
     }
+    // sectors are read as whole device blocks
+    if (unlikely(this->sector_size % device.block_size()))
+    {
+      printf("Sector size (%u) is not a multiple of the device block size (%u)\n",
+             sector_size, (unsigned) device.block_size());
+      return true;
+    }
+    this->blocks_per_sector = this->sector_size / device.block_size();
     
     // Let's begin our incantation
     // To drive out the demons of old DOS we have to read some PBP values
@@ -69,10 +83,11 @@ namespace fs
       this->sectors  = bpb->small_sectors;
     else
       this->sectors  = bpb->large_sectors;
-    // sectors per FAT (not sure about the rule here)
+    // sectors per FAT, FAT32 keeps it in the extended BPB
+    auto* bpb32 = mbr->bpb32();
     this->sectors_per_fat = bpb->sectors_per_fat;
     if (this->sectors_per_fat == 0)
-        this->sectors_per_fat = *(uint32_t*) &mbr->boot[25];
+        this->sectors_per_fat = bpb32->sectors_per_fat;
     // root dir sectors from root entries
     this->root_dir_sectors = ((bpb->root_entries * 32) + (sector_size - 1)) / sector_size;
     // calculate index of first data sector
@@ -108,16 +123,78 @@ namespace fs
     else
     {
       this->fat_type = FAT::T_FAT32;
-      this->root_cluster = *(uint32_t*) &mbr->boot[33];
-      this->root_cluster = 2;
+      this->root_cluster = bpb32->root_cluster;
       debug("The image is type FAT32, with %u clusters\n", this->clusters);
-      //printf("Root dir entries: %u clusters\n", bpb->root_entries);
-      //assert(bpb->root_entries == 0);
-      //this->root_dir_sectors = 0;
-      //this->data_index = bpb->reserved_sectors + bpb->fa_tables * this->sectors_per_fat;
+      if (unlikely(this->root_cluster < 2 || this->root_cluster >= this->clusters + 2))
+      {
+        printf("Invalid root cluster (%u) for FAT32 partition\n", root_cluster);
+        return true;
+      }
     }
     debug("Root cluster index: %u (sector %u)\n", this->root_cluster, cl_to_sector(root_cluster));
+    
+    // FAT32 free space is recorded in the FSInfo sector, read on mount
+    this->fsinfo_sector = 0;
+    if (this->fat_type == FAT::T_FAT32
+     && bpb32->fsinfo_sector != 0 && bpb32->fsinfo_sector < this->reserved)
+        this->fsinfo_sector = bpb32->fsinfo_sector;
+    this->free_clusters = FSINFO_UNKNOWN;
+    this->next_free     = 0;
+    
+    // forget everything cached from any previous mount
+    clear_caches();
     debug("System ID: %.8s\n", bpb->system_id);
+    return no_error;
+  }
+  
+  void FAT::load_fsinfo(const void* data)
+  {
+    auto* info = (const fsinfo_t*) data;
+    if (info->lead_sig   != FSINFO_LEAD_SIG
+     || info->struct_sig != FSINFO_STRUCT_SIG
+     || info->trail_sig  != FSINFO_TRAIL_SIG)
+    {
+      debug("FSInfo: invalid signatures\n");
+      return;
+    }
+    // either value can be unknown, or stale enough to be impossible
+    if (info->free_count <= this->clusters)
+        this->free_clusters = info->free_count;
+    if (info->next_free >= 2 && info->next_free < this->clusters + 2)
+        this->next_free = info->next_free;
+    debug("FSInfo: free=%u next=%u\n", this->free_clusters.load(), this->next_free);
+  }
+  
+  error_t FAT::statfs(Statfs& st)
+  {
+    st.block_size  = this->sector_size * this->sectors_per_cluster;
+    st.blocks      = this->clusters;
+    const uint32_t free = this->free_clusters;
+    st.blocks_free = (free != FSINFO_UNKNOWN) ? free : FREE_UNKNOWN;
+    return no_error;
+  }
+  
+  void FAT::clear_caches()
+  {
+    {
+      std::lock_guard<std::mutex> lock(fat_cache_mtx);
+      for (auto& slot : fat_cache)
+          slot.data = nullptr;
+    }
+    {
+      std::lock_guard<std::mutex> lock(extent_cache_mtx);
+      extent_cache.clear();
+    }
+    {
+      std::lock_guard<std::mutex> lock(dir_index_mtx);
+      dir_indexes.clear();
+    }
+    {
+      std::lock_guard<std::mutex> lock(stream_mtx);
+      for (auto& s : streams)
+          s = stream_t();
+    }
+    dcache.clear();
   }
   
   void FAT::mount(uint64_t base, uint64_t size, on_mount_func on_mount)
@@ -138,12 +215,16 @@ namespace fs
       assert(mbr->magic == 0xAA55);
       
       // initialize FAT16 or FAT32 filesystem
-      init(mbr);
+      if (init(mbr))
+      {
+        on_mount(true);
+        return;
+      }
       
       // determine which FAT version is mounted
       std::string inf = "ofs: " + std::to_string(lba_base) +
                         "size: " + std::to_string(lba_size) +
-  " (" + std::to_string(this->lba_size * sector_size) + " bytes)\n";
+  " (" + std::to_string(this->lba_size * device.block_size()) + " bytes)\n";
       
       switch (this->fat_type)
       {
@@ -157,250 +238,371 @@ namespace fs
           INFO("FS", "Mounting FAT32 filesystem");
           break;
       }
-      INFO2("[ofs=%u  size=%u (%u bytes)]\n", 
-          this->lba_base, this->lba_size, this->lba_size * 512);
-      
-      // on_mount callback
-      on_mount(no_error);
-    });
-  }
-  
-  bool FAT::int_dirent(
-      uint32_t  sector,
-      const void* data, 
-      dirvec_t dirents)
-  {
-      auto* root = (cl_dir*) data;
-      bool  found_last = false;
+      INFO2("[ofs=%u  size=%u (%llu bytes)]\n", 
+          this->lba_base, this->lba_size,
+          (unsigned long long) this->lba_size * device.block_size());
       
-      for (int i = 0; i < 16; i++)
+      // FAT32: load the free space counters before finishing,
+      // a missing or unreadable FSInfo sector just leaves them unknown
+      if (this->fsinfo_sector)
       {
-        if (unlikely(root[i].shortname[0] == 0x0))
-        {
-          //printf("end of dir\n");
-          found_last = true;
-          // end of directory
-          break;
-        }
-        else if (unlikely(root[i].shortname[0] == 0xE5))
-        {
-          // unused index
-        }
-        else
+        read_sectors(this->fsinfo_sector, 1,
+        [this, on_mount] (buffer_t data)
         {
-            // traverse long names, then final cluster
-            // to read all the relevant info
-            
-            if (likely(root[i].is_longname()))
-            {
-              auto* L = (cl_long*) &root[i];
-              // the last long index is part of a chain of entries
-              if (L->is_last())
-              {
-                // buffer for long filename
-                char final_name[256];
-                int  final_count = 0;
-                
-                int  total = L->long_index();
-                // go to the last entry and work backwards
-                i += total-1;
-                L += total-1;
-                
-                for (int idx = total; idx > 0; idx--)
-                {
-                  uint16_t longname[13];
-                  memcpy(longname+ 0, L->first, 10);
-                  memcpy(longname+ 5, L->second, 12);
-                  memcpy(longname+11, L->third, 4);
-                  
-                  for (int j = 0; j < 13; j++)
-                  {
-                    // 0xFFFF indicates end of name
-                    if (unlikely(longname[j] == 0xFFFF)) break;
-                    // sometimes, invalid stuff are snuck into filenames
-                    if (unlikely(longname[j] == 0x0)) break;
-                    
-                    final_name[final_count] = longname[j] & 0xFF;
-                    final_count++;
-                  }
-                  L--;
-                  
-                  if (unlikely(final_count > 240))
-                  {
-                    debug("Suspicious long name length, breaking...\n");
-                    break;
-                  }
-                }
-                
-                final_name[final_count] = 0;
-                debug("Long name: %s\n", final_name);
-                
-                i++; // skip over the long version
-                // to the short version for the stats and cluster
-                auto* D = &root[i];
-                std::string dirname(final_name, final_count);
-                dirname = trim_right_copy(dirname);
-                
-                dirents->emplace_back(
-                  D->type(), 
-                  dirname, 
-                  D->dir_cluster(root_cluster), 
-                  sector, // parent block
-                  D->size(), 
-                  D->attrib);
-              }
-            }
-            else
-            {
-              auto* D = &root[i];
-              debug("Short name: %.11s\n", D->shortname);
-              
-              std::string dirname((char*) D->shortname, 11);
-              dirname = trim_right_copy(dirname);
-              
-              dirents->emplace_back(
-                D->type(), 
-                dirname, 
-                D->dir_cluster(root_cluster), 
-                sector, // parent block
-                D->size(), 
-                D->attrib);
-            }
-        }
-      } // directory list
+          if (data) load_fsinfo(data.get());
+          on_mount(no_error);
+        });
+        return;
+      }
       
-      return found_last;
+      // on_mount callback
+      on_mount(no_error);
+    });
   }
   
-  void FAT::int_ls(
-      uint32_t sector, 
-      dirvec_t dirents, 
-      on_internal_ls_func callback)
+  void FAT::dir_scan(
+      uint32_t cluster, 
+      on_dir_sector_func on_sector, 
+      on_mount_func on_done)
   {
-    // list contents of meme sector by sector
-    typedef std::function<void(uint32_t)> next_func_t;
+    // read directory cluster by cluster, following the cluster chain
+    typedef std::function<void(uint32_t, uint32_t, uint32_t)> next_func_t;
+    
+    const uint32_t start = cl_normalize(cluster);
+    auto* next = new next_func_t;
     
-    auto next = std::make_shared<next_func_t> ();
     *next = 
-    [this, sector, callback, dirents, next] (uint32_t sector)
+    [this, start, on_sector, on_done, next] (uint32_t cluster, uint32_t index, uint32_t visited)
     {
-      debug("int_ls: sec=%u\n", sector);
-      device.read(sector,
-      [this, sector, callback, dirents, next] (buffer_t data)
+      uint32_t sector = this->cl_to_sector(cluster) + index;
+      uint32_t count  = cl_chunk(cluster, index);
+      debug("dir_scan: sec=%u count=%u\n", sector, count);
+      read_sectors(sector, count,
+      [this, start, cluster, index, visited, sector, count, &on_sector, &on_done, next] (buffer_t data)
       {
         if (!data)
         {
-          // could not read sector
-          callback(true, dirents);
+          // could not read cluster
+          on_done(true);
+          // cleanup (after callback)
+          delete next;
           return;
         }
         
-        // parse entries in sector
-        bool done = int_dirent(sector, data.get(), dirents);
-        if (done)
+        // parse entries sector by sector
+        bool done = false;
+        for (uint32_t i = 0; i < count && !done; i++)
+            done = on_sector(sector + i, data.get() + i * this->sector_size);
+        // there is more: start fetching the rest of the directory
+        if (!done && cluster == start && index == 0)
+            dir_prefetch(start);
+        
+        uint32_t cl   = cluster;
+        uint32_t idx  = index;
+        uint32_t seen = visited;
+        if (done || !next_chunk(cl, idx, count, seen))
         {
-          // execute callback
-          callback(no_error, dirents);
+          // execute callback, a broken chain is an error
+          on_done(!done && cl == CL_BAD);
+          // cleanup (after callback)
+          delete next;
         }
         else
         {
-          // go to next sector
-          (*next)(sector+1);
+          // go to next cluster
+          (*next)(cl, idx, seen);
         }
         
-      }); // read root dir
+      }); // read dir sector
     };
     
     // start reading sectors asynchronously
-    (*next)(sector);
+    fat_prefetch(start);
+    (*next)(start, 0, 1);
   }
   
-  void FAT::traverse(std::shared_ptr<Path> path, cluster_func callback)
+  void FAT::int_ls(
+      uint32_t cluster, 
+      dirvec_t dirents, 
+      on_internal_ls_func callback)
   {
-    // parse this path into a stack of memes
-    typedef std::function<void(uint32_t)> next_func_t;
+    auto decoder = std::make_shared<dir_decoder> ();
     
-    // asynch stack traversal
-    auto next = std::make_shared<next_func_t> ();
-    *next = 
-    [this, path, next, callback] (uint32_t cluster)
+    dir_scan(cluster,
+    [this, decoder, dirents] (uint32_t sector, const uint8_t* data)
     {
-      if (path->empty())
+      return int_dirent(*decoder, sector, data, dirents);
+    },
+    [dirents, callback] (error_t error)
+    {
+      callback(error, dirents);
+    });
+  }
+  
+  void FAT::int_find(uint32_t cluster, const std::string& name, on_lookup_func callback)
+  {
+    auto decoder = std::make_shared<dir_decoder> ();
+    auto found   = std::make_shared<Dirent> (INVALID_ENTITY, name);
+    
+    // stop reading the directory as soon as the name shows up
+    dir_scan(cluster,
+    [this, decoder, name, found] (uint32_t sector, const uint8_t* data)
+    {
+      return int_find(*decoder, sector, data, name, *found);
+    },
+    [found, callback] (error_t error)
+    {
+      callback(error, *found);
+    });
+  }
+  
+  void FAT::lookup(uint32_t cluster, const std::string& name, on_lookup_func callback)
+  {
+    Dirent found(INVALID_ENTITY, name);
+    if (dcache.lookup(cl_normalize(cluster), name, found))
+    {
+      callback(!found.is_valid(), found);
+      return;
+    }
+    if (dir_index_lookup(cluster, name, found))
+    {
+      dcache.insert(cl_normalize(cluster), name, found);
+      callback(!found.is_valid(), found);
+      return;
+    }
+    
+    auto on_found =
+    [this, cluster, name, callback] (error_t error, const Dirent& found)
+    {
+      if (unlikely(error))
       {
-        // attempt to read directory
-        uint32_t S = this->cl_to_sector(cluster);
-        
-        // result allocated on heap
-        auto dirents = std::make_shared<std::vector<Dirent>> ();
-        
-        int_ls(S, dirents,
-        [callback] (error_t error, dirvec_t ents)
-        {
-          callback(error, ents);
-        });
+        debug("Could not read directory at cluster %u\n", cluster);
+        callback(true, Dirent(INVALID_ENTITY, name));
         return;
       }
+      if (!found.is_valid())
+          debug("NO MATCH for %s\n", name.c_str());
       
+      dcache.insert(cl_normalize(cluster), name, found);
+      callback(!found.is_valid(), found);
+    };
+    
+    if (!dir_index_enabled)
+    {
+      int_find(cluster, name, on_found);
+      return;
+    }
+    
+    // list the whole directory, so that it can be indexed
+    auto dirents = new_shared_vector();
+    int_ls(cluster, dirents,
+    [this, cluster, name, on_found] (error_t error, dirvec_t ents)
+    {
+      if (unlikely(error))
+          on_found(true, Dirent(INVALID_ENTITY, name));
+      else
+          on_found(no_error, dir_find(cluster, ents, name));
+    });
+  }
+  
+  FAT::path_op* FAT::op_acquire(const std::string& path)
+  {
+    path_op* op = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(op_pool_mtx);
+      if (!op_pool.empty())
+      {
+        op = op_pool.back().release();
+        op_pool.pop_back();
+      }
+    }
+    if (op == nullptr) op = new path_op;
+    
+    // start at the root directory
+    op->path = path;
+    op->dir  = 0;
+    op->found = Dirent(DIR, "", 0);
+    return op;
+  }
+  
+  void FAT::op_release(path_op* op)
+  {
+    // drop whatever the callbacks captured
+    op->on_walk  = nullptr;
+    op->on_found = nullptr;
+    
+    std::lock_guard<std::mutex> lock(op_pool_mtx);
+    if (op_pool.size() < PATH_OP_POOL)
+        op_pool.emplace_back(op);
+    else
+        delete op;
+  }
+  
+  void FAT::op_finish(path_op* op, error_t error)
+  {
+    // recycle the operation before calling back,
+    // so that the callback can start another one
+    auto on_walk  = std::move(op->on_walk);
+    auto on_found = std::move(op->on_found);
+    Dirent found  = std::move(op->found);
+    uint32_t dir  = op->dir;
+    op_release(op);
+    
+    if (on_walk)
+        on_walk(error, error ? 0 : dir);
+    else
+        on_found(error, found);
+  }
+  
+  bool FAT::op_enter(path_op* op)
+  {
+    // only directories can be followed, and walks end in one
+    if (unlikely(!op->found.is_valid()))
+    {
+      debug("NO MATCH for %s\n", op->name.c_str());
+      op_finish(op, true);
+      return false;
+    }
+    if ((op->on_walk || !op->path.empty()) && op->found.type() != DIR)
+    {
+      op_finish(op, true);
+      return false;
+    }
+    // enter the matching directory
+    debug("\t\t cluster: %lu\n", op->found.block);
+    op->dir = op->found.block;
+    return true;
+  }
+  
+  void FAT::op_step(path_op* op)
+  {
+    while (!op->path.empty())
+    {
       // retrieve next name
-      std::string name = path->front();
-      path->pop_front();
-      
-      uint32_t S = this->cl_to_sector(cluster);
-      debug("Current target: %s on cluster %u (sector %u)\n", name.c_str(), cluster, S);
-      
-      // result allocated on heap
-      auto dirents = std::make_shared<std::vector<Dirent>> ();
+      op->name = op->path.front();
+      op->path.pop_front();
+      debug("Current target: %s on cluster %u\n", op->name.c_str(), op->dir);
       
-      // list directory contents
-      int_ls(S, dirents,
-      [name, dirents, next, callback] (error_t error, dirvec_t ents)
+      if (dcache.lookup(cl_normalize(op->dir), op->name, op->found))
       {
-        if (unlikely(error))
-        {
-          debug("Could not find: %s\n", name.c_str());
-          callback(true, dirents);
-          return;
-        }
-        
-        // look for name in directory
-        for (auto& e : *ents)
+        if (!op_enter(op)) return;
+        continue;
+      }
+      if (dir_index_lookup(op->dir, op->name, op->found))
+      {
+        dcache.insert(cl_normalize(op->dir), op->name, op->found);
+        if (!op_enter(op)) return;
+        continue;
+      }
+      if (dir_index_enabled)
+      {
+        // the listing is needed for indexing
+        lookup(op->dir, op->name,
+        [this, op] (error_t error, const Dirent& e)
         {
-          if (unlikely(e.name() == name))
-          {
-            // go to this directory, unless its the last name
-            debug("Found match for %s", name.c_str());
-            // enter the matching directory
-            debug("\t\t cluster: %llu\n", e.block);
-            // only follow directories
-            if (e.type() == DIR)
-              (*next)(e.block);
-            else
-              callback(true, dirents);
-            return;
-          }
-        } // for (ents)
-        
-        debug("NO MATCH for %s\n", name.c_str());
-        callback(true, dirents);
-      });
+          // errors leave the entry invalid
+          (void) error;
+          op->found = e;
+          if (op_enter(op)) op_step(op);
+        });
+        return;
+      }
       
-    };
-    // start by reading root directory
-    (*next)(0);
+      // scan the directory until the name shows up
+      op->cluster = cl_normalize(op->dir);
+      op->index   = 0;
+      op->visited = 1;
+      op->decoder = dir_decoder();
+      op->found   = Dirent(INVALID_ENTITY);
+      fat_prefetch(op->cluster);
+      op_scan(op);
+      return;
+    }
+    op_finish(op, no_error);
   }
   
-  void FAT::ls(const std::string& path, on_ls_func on_ls)
+  void FAT::op_scan(path_op* op)
   {
-    // parse this path into a stack of names
-    auto pstk = std::make_shared<Path> (path);
+    op->sector = this->cl_to_sector(op->cluster) + op->index;
+    op->count  = cl_chunk(op->cluster, op->index);
+    debug("op_scan: sec=%u count=%u\n", op->sector, op->count);
     
-    traverse(pstk, 
-    [on_ls] (error_t error, dirvec_t dirents)
+    read_sectors(op->sector, op->count,
+    [this, op] (buffer_t data)
+    {
+      if (unlikely(!data))
+      {
+        // could not read cluster
+        op_finish(op, true);
+        return;
+      }
+      bool done = false;
+      for (uint32_t i = 0; i < op->count && !done; i++)
+          done = int_find(op->decoder, op->sector + i,
+                          data.get() + i * this->sector_size, op->name, op->found);
+      if (!done && op->index == 0 && op->cluster == cl_normalize(op->dir))
+          dir_prefetch(op->cluster);
+      if (!done && next_chunk(op->cluster, op->index, op->count, op->visited))
+      {
+        op_scan(op);
+        return;
+      }
+      if (unlikely(!done && op->cluster == CL_BAD))
+      {
+        // the chain is broken or loops
+        op_finish(op, true);
+        return;
+      }
+      // found, or the end of the directory
+      dcache.insert(cl_normalize(op->dir), op->name, op->found);
+      if (op_enter(op)) op_step(op);
+    });
+  }
+  
+  void FAT::walk(const std::string& path, on_walk_func callback)
+  {
+    auto* op = op_acquire(path);
+    op->on_walk = std::move(callback);
+    op_step(op);
+  }
+  
+  void FAT::resolve(const std::string& path, on_lookup_func callback)
+  {
+    auto* op = op_acquire(path);
+    if (unlikely(op->path.empty()))
     {
-      on_ls(error, dirents);
+      // the root directory has no entry
+      op_release(op);
+      callback(true, Dirent(INVALID_ENTITY, path));
+      return;
+    }
+    op->on_found = std::move(callback);
+    op_step(op);
+  }
+  
+  void FAT::traverse(const std::string& path, cluster_func callback)
+  {
+    walk(path,
+    [this, callback] (error_t error, uint32_t cluster)
+    {
+      // result allocated on heap
+      auto dirents = new_shared_vector();
+      
+      if (unlikely(error))
+      {
+        callback(true, dirents);
+        return;
+      }
+      // attempt to read directory
+      int_ls(cluster, dirents, callback);
     });
   }
   
+  void FAT::ls(const std::string& path, on_ls_func on_ls)
+  {
+    traverse(path, on_ls);
+  }
+  
   void FAT::read(const Dirent& ent, uint64_t pos, uint64_t n, on_read_func callback)
   {
     auto buf = read(ent, pos, n);
@@ -409,135 +611,110 @@ namespace fs
   
   void FAT::readFile(const Dirent& ent, on_read_func callback)
   {
-    // cluster -> sector
-    uint32_t sector = this->cl_to_sector(ent.block);
-    // number of sectors to read ahead
-    size_t chunks = ent.size / sector_size + 1;
-    // allocate buffer
-    auto* buffer = new uint8_t[chunks * sector_size];
-    // at which sector we will stop
-    size_t total   = chunks;
-    size_t current = 0;
-    
-    typedef std::function<void(uint32_t, size_t, size_t)> next_func_t;
+    readFile(ent, pool.get(ent.size), std::move(callback));
+  }
+  
+  void FAT::readFile(const Dirent& ent, buffer_t buffer, on_read_func callback)
+  {
+    if (unlikely(buffer.size() < ent.size))
+    {
+      // the file does not fit
+      callback(true, buffer_t(), 0);
+      return;
+    }
+    // number of sectors in the file
+    size_t total = (ent.size + sector_size - 1) / sector_size;
+    // the clusters of the file, as runs
+    auto map = extents(ent.block);
+    if (unlikely(!map || (total && map->empty())))
+    {
+      // file has a size, but no clusters
+      callback(true, buffer_t(), 0);
+      return;
+    }
+    typedef std::function<void(size_t, uint32_t, size_t)> next_func_t;
     auto* next = new next_func_t;
     
     *next = 
-    [this, buffer, ent, callback, next] (uint32_t sector, size_t current, size_t total)
+    [this, buffer, ent, callback, next, total, map] (size_t ext, uint32_t index, size_t current)
     {
       if (unlikely(current == total))
       {
         // report back to HQ
         debug("DONE SIZE: %lu  (current=%lu, total=%lu)\n", 
             ent.size, current, total);
-        // create shared buffer
-        auto buffer_ptr = buffer_t(buffer, std::default_delete<uint8_t[]>());
         // notify caller
-        callback(no_error, buffer_ptr, ent.size);
+        callback(no_error, buffer.slice(0, ent.size), ent.size);
+        // cleanup (after callback)
+        delete next;
+        return;
+      }
+      // the chain must continue until the whole file is read
+      if (unlikely(ext == map->size()))
+      {
+        debug("Cluster chain ended early for readFile()\n");
+        callback(true, buffer_t(), 0);
         // cleanup (after callback)
         delete next;
         return;
       }
-      device.read(sector,
-      [this, current, total, buffer, ent, &callback, sector, next] (buffer_t data)
+      const auto& run = (*map)[ext];
+      uint32_t sector = this->cl_to_sector(run.cluster) + index;
+      // read as much of the run as possible in one request
+      uint32_t run_left = run.count * sectors_per_cluster - index;
+      uint32_t count = std::min<size_t>(total - current, run_left);
+      count = std::min(count, READ_MAX_SECTORS);
+      
+      read_sectors(sector, count,
+      [this, ext, index, current, count, run_left, buffer, &ent, &callback, sector, next] (buffer_t data)
       {
         if (!data)
         {
           // general I/O error occurred
-          debug("Failed to read sector %u for read()", sector);
-          // cleanup
-          delete next;
-          delete[] buffer;
+          debug("Failed to read sectors %u-%u for read()", sector, sector + count);
           callback(true, buffer_t(), 0);
+          // cleanup (after callback)
+          delete next;
           return;
         }
         
-        // copy over data
-        memcpy(buffer + current * sector_size, data.get(), sector_size);
-        // continue reading next sector
-        (*next)(sector+1, current+1, total);
+        // copy over data, but not past the end of the file
+        size_t offset = current * sector_size;
+        size_t len = std::min<size_t>(count * sector_size, ent.size - offset);
+        memcpy(buffer.get() + offset, data.get(), len);
+        // continue reading this run, or the next one
+        if (count < run_left)
+          (*next)(ext, index + count, current + count);
+        else
+          (*next)(ext+1, 0, current + count);
       });
     };
     
     // start!
-    (*next)(sector, current, total);
+    (*next)(0, 0, 0);
   }
   
   void FAT::readFile(const std::string& strpath, on_read_func callback)
   {
-    auto path = std::make_shared<Path> (strpath);
-    if (unlikely(path->empty()))
-    {
-      // there is no possible file to read where path is empty
-      callback(true, nullptr, 0);
-      return;
-    }
-    debug("readFile: %s\n", path->back().c_str());
-    
-    std::string filename = path->back();
-    path->pop_back();
+    debug("readFile: %s\n", strpath.c_str());
     
-    traverse(path,
-    [this, filename, &callback] (error_t error, dirvec_t dirents)
+    resolve(strpath,
+    [this, callback] (error_t error, const Dirent& e)
     {
       if (unlikely(error))
       {
-        // no path, no file!
-        callback(error, nullptr, 0);
+        // file not found
+        callback(true, nullptr, 0);
         return;
       }
-      
-      // find the matching filename in directory
-      for (auto& e : *dirents)
-      {
-        if (unlikely(e.name() == filename))
-        {
-          // read this file
-          readFile(e, callback);
-          return;
-        }
-      }
+      // read this file
+      readFile(e, callback);
     });
   } // readFile()
   
   void FAT::stat(const std::string& strpath, on_stat_func callback)
   {
-    auto path = std::make_shared<Path> (strpath);
-    if (unlikely(path->empty()))
-    {
-      // root doesn't have any stat anyways (except ATTR_VOLUME_ID in FAT)
-      callback(true, Dirent(INVALID_ENTITY, strpath));
-      return;
-    }
-    
-    debug("stat: %s\n", path->back().c_str());
-    // extract file we are looking for
-    std::string filename = path->back();
-    path->pop_back();
-    
-    traverse(path,
-    [this, filename, &callback] (error_t error, dirvec_t dirents)
-    {
-      if (unlikely(error))
-      {
-        // no path, no file!
-        callback(error, Dirent(INVALID_ENTITY, filename));
-        return;
-      }
-      
-      // find the matching filename in directory
-      for (auto& e : *dirents)
-      {
-        if (unlikely(e.name() == filename))
-        {
-          // read this file
-          callback(no_error, e);
-          return;
-        }
-      }
-      
-      // not found
-      callback(true, Dirent(INVALID_ENTITY, filename));
-    });
+    debug("stat: %s\n", strpath.c_str());
+    resolve(strpath, std::move(callback));
   }
 }
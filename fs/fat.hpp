@@ -20,15 +20,20 @@
 #define FS_FAT_HPP
 
 #include "filesystem.hpp"
+#include "dcache.hpp"
+#include "buffer_pool.hpp"
+#include "path.hpp"
 #include <hw/disk_device.hpp>
 #include <functional>
 #include <cstdint>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace fs
 {
-  class Path;
-  
   struct FAT : public FileSystem
   {
     /// ----------------------------------------------------- ///
@@ -36,20 +41,30 @@ namespace fs
     
     // path is a path in the mounted filesystem
     virtual void    ls     (const std::string& path, on_ls_func) override;
-    virtual error_t ls(const std::string& path, dirvec_t) override;
+    using FileSystem::ls;
+    
+    // stream the entries of a directory
+    virtual cursor_t begin(const std::string& path) override;
     
     // read an entire file into a buffer, then call on_read
     virtual void readFile(const std::string&, on_read_func) override;
     virtual void readFile(const Dirent& ent, on_read_func) override;
+    virtual void readFile(const Dirent& ent, buffer_t dest, on_read_func) override;
     
     /** Read @n bytes from file pointed by @entry starting at position @pos */
     virtual void   read(const Dirent&, uint64_t pos, uint64_t n, on_read_func) override;
     virtual Buffer read(const Dirent&, uint64_t pos, uint64_t n) override;
+    virtual Buffer read(const Dirent&, uint64_t pos, buffer_t dest) override;
+    virtual error_t readv(const Dirent&, uint64_t pos, uint64_t n, slices_t&) override;
     
     // return information about a filesystem entity
     virtual void   stat(const std::string&, on_stat_func) override;
     virtual Dirent stat(const std::string& ent) override;
     
+    // capacity from the BPB, and on FAT32 the free count from FSInfo,
+    // which is what the last writer recorded and is not verified
+    virtual error_t statfs(Statfs&) override;
+    
     // returns the name of the filesystem
     virtual std::string name() const override
     {
@@ -70,6 +85,34 @@ namespace fs
     FAT(hw::IDiskDevice& idev);
     virtual ~FAT() = default;
     
+    // index the names of large directories in memory on first lookup
+    void enable_dir_index(bool enabled);
+    // read ahead of files that are read sequentially (on by default)
+    void enable_readahead(bool enabled);
+    // FAT32 FSInfo hint of where to look for free clusters, 0 if unknown
+    uint32_t next_free_hint() const noexcept
+    { return next_free; }
+    
+    // cluster counts from a scan of the whole FAT
+    struct fat_stats_t
+    {
+      uint32_t clusters;  // data clusters on the volume
+      uint32_t free;
+      uint32_t used;      // allocated, including the ends of chains
+      uint32_t bad;
+      uint32_t fragments; // contiguous runs in all the chains
+    };
+    // scan the FAT on @threads threads (0 for one per CPU), the free
+    // count then replaces the FSInfo one that statfs() reports
+    error_t scan_fat(fat_stats_t&, unsigned threads = 0);
+    // what the scan counts in a range of the FAT
+    struct scan_counts_t
+    {
+      uint64_t free   = 0;
+      uint64_t bad    = 0;
+      uint64_t linked = 0; // entries pointing at the next cluster
+    };
+    
   private:
     // FAT types
     static const int T_FAT12 = 0;
@@ -151,46 +194,371 @@ namespace fs
     } __attribute__((packed));
     
     // helper functions
+    // sectors are partition-relative, in units of bytes_per_sector
     uint32_t cl_to_sector(uint32_t cl)
     {
       if (cl == 0)
-        return lba_base + data_index + (this->root_cluster - 2) * sectors_per_cluster - this->root_dir_sectors;
+        return data_index + (this->root_cluster - 2) * sectors_per_cluster - this->root_dir_sectors;
       else
-        return lba_base + data_index + (cl - 2) * sectors_per_cluster;
+        return data_index + (cl - 2) * sectors_per_cluster;
+    }
+    
+    /// device I/O ///
+    // a sector is one or more whole device blocks
+    uint64_t sector_to_block(uint32_t sector) const
+    {
+      return lba_base + (uint64_t) sector * blocks_per_sector;
+    }
+    buffer_t read_sectors(uint32_t sector, uint32_t count)
+    {
+      return device.read_sync(sector_to_block(sector), count * blocks_per_sector);
+    }
+    template <typename Func>
+    void read_sectors(uint32_t sector, uint32_t count, Func func)
+    {
+      device.read(sector_to_block(sector), count * blocks_per_sector, std::move(func));
+    }
+    void prefetch_sectors(uint32_t sector, uint32_t count)
+    {
+      device.prefetch(sector_to_block(sector), count * blocks_per_sector);
     }
     
-    uint16_t cl_to_entry_offset(uint32_t cl)
+    uint32_t cl_to_entry_offset(uint32_t cl)
     {
-      if (fat_type == T_FAT16)
+      if (fat_type == T_FAT12)
+          return (cl + cl / 2) % sector_size;
+      else if (fat_type == T_FAT16)
           return (cl * 2) % sector_size;
       else // T_FAT32
           return (cl * 4) % sector_size;
     }
-    uint16_t cl_to_entry_sector(uint32_t cl)
+    uint32_t cl_to_entry_sector(uint32_t cl)
     {
-      if (fat_type == T_FAT16)
+      if (fat_type == T_FAT12)
+          return reserved + ((cl + cl / 2) / sector_size);
+      else if (fat_type == T_FAT16)
           return reserved + (cl * 2 / sector_size);
       else // T_FAT32
           return reserved + (cl * 4 / sector_size);
     }
     
+    /// FAT table ///
+    // FAT entries are normalized to the FAT32 value range
+    static const uint32_t CL_FREE = 0x0;
+    static const uint32_t CL_BAD  = 0x0FFFFFF7;
+    static const uint32_t CL_EOC  = 0x0FFFFFF8; // and above
+    
+    // true if @cl does not continue a cluster chain
+    static bool cl_is_end(uint32_t cl)
+    {
+      return cl < 2 || cl >= CL_BAD;
+    }
+    // the directory at cluster 0 is the root directory
+    uint32_t cl_normalize(uint32_t cl) const
+    {
+      return (cl == 0 && fat_type == T_FAT32) ? root_cluster : cl;
+    }
+    // sectors in the cluster @cl (the FAT12/16 root region for cluster 0)
+    uint32_t cl_sectors(uint32_t cl) const
+    {
+      return (cl == 0) ? root_dir_sectors : sectors_per_cluster;
+    }
+    // returns the decoded FAT entry for @cl, which is the next
+    // cluster in the chain, or CL_BAD if the FAT could not be read
+    // or the entry is not a valid cluster
+    // without @read only cached FAT sectors are used, and CL_FREE
+    // is returned when the entry is not in one of them
+    uint32_t cl_next(uint32_t cl, bool read = true);
+    // sectors of @cl from @index that are read in one request,
+    // which is the whole cluster unless it is the large FAT12/16 root
+    uint32_t cl_chunk(uint32_t cl, uint32_t index) const
+    {
+      uint32_t left = cl_sectors(cl) - index;
+      return (left < READ_MAX_SECTORS) ? left : READ_MAX_SECTORS;
+    }
+    // advance past the @count sectors at @index of a cluster chain,
+    // counting the clusters entered in @visited (1 for the first),
+    // returns false when there are no more sectors in the chain,
+    // with @cl set to CL_BAD if the chain is broken or loops
+    bool next_chunk(uint32_t& cl, uint32_t& index, uint32_t count, uint32_t& visited);
+    // returns the partition-relative FAT sector @sector,
+    // or an empty buffer without @read if it is not cached
+    buffer_t fat_sector(uint32_t sector, bool read = true);
+    
+    // direct-mapped cache of FAT sectors
+    static const int FAT_CACHE_SLOTS = 64;
+    struct fat_slot
+    {
+      uint32_t sector;
+      buffer_t data;
+    };
+    fat_slot   fat_cache[FAT_CACHE_SLOTS];
+    std::mutex fat_cache_mtx;
+    
+    /// extent maps ///
+    // a run of contiguous clusters in a cluster chain
+    struct extent_t
+    {
+      uint32_t offset;  // index of the first cluster in the chain
+      uint32_t cluster; // first cluster of the run
+      uint32_t count;   // number of clusters in the run
+    };
+    typedef std::vector<extent_t> extent_map;
+    typedef std::shared_ptr<const extent_map> extents_t;
+    
+    // upper limit for sectors in a single device request
+    static const uint32_t READ_MAX_SECTORS = 128;
+    /// sequential readahead ///
+    // a file being read, and what has been read ahead of it
+    struct stream_t
+    {
+      uint32_t file    = 0;     // first cluster, 0 if unused
+      uint64_t next    = 0;     // where a sequential read would start
+      uint32_t window  = 0;     // sectors to read ahead, 0 if not sequential
+      uint64_t last    = 0;     // for replacing the least recently used
+      bool     pending = false; // a readahead is in flight
+      uint64_t pending_pos = 0; // and where it starts
+      uint64_t ahead_pos = 0;   // file position of @ahead
+      buffer_t ahead;
+    };
+    static const int      RA_STREAMS     = 8;
+    static const uint32_t RA_MIN_SECTORS = 8;
+    // readaheads are single device reads, up to READ_MAX_SECTORS
+    
+    // record a read of @n bytes at @pos in @file, returning the window
+    // and what was read ahead (copies, the stream can change meanwhile)
+    uint32_t ra_access(uint32_t file, uint64_t pos, uint64_t n,
+                       buffer_t& ahead, uint64_t& ahead_pos);
+    // keep @data, from @pos in @file, for the next sequential read
+    void     ra_store(uint32_t file, uint64_t pos, buffer_t data);
+    // start reading @window sectors of @ent from @pos in the background,
+    // unless the stream already has data or a read in flight there
+    void     ra_prefetch(const Dirent& ent, uint64_t pos, uint32_t window);
+    
+    std::atomic<bool> readahead_enabled {true};
+    stream_t   streams[RA_STREAMS];
+    uint64_t   stream_clock = 0;
+    std::mutex stream_mtx;
+    
+    // read @n bytes of @ent from @pos in as few device reads as possible,
+    // passing each part to @on_data(buffer_t) as a view of the device buffer
+    template <typename Func>
+    error_t read_range(const Dirent& ent, uint64_t pos, uint64_t n, Func on_data);
+    
+    // returns the run-length encoded chain starting at @cl,
+    // or nullptr if the chain could not be followed
+    extents_t extents(uint32_t cl);
+    // returns the extent containing the cluster @offset in the chain
+    static extent_map::const_iterator
+    extent_find(const extent_map& map, uint32_t offset);
+    
+    // extent maps built so far, by first cluster
+    static const size_t EXTENT_CACHE_MAX = 256;
+    std::unordered_map<uint32_t, extents_t> extent_cache;
+    std::mutex extent_cache_mtx;
+    
     // initialize filesystem by providing base sector
-    void init(const void* base_sector);
+    error_t init(const void* base_sector);
+    
+    /// FAT32 FSInfo ///
+    struct fsinfo_t
+    {
+      uint32_t lead_sig;      // FSINFO_LEAD_SIG
+      uint8_t  reserved1[480];
+      uint32_t struct_sig;    // FSINFO_STRUCT_SIG
+      uint32_t free_count;    // free clusters, or FSINFO_UNKNOWN
+      uint32_t next_free;     // cluster to start looking from, or FSINFO_UNKNOWN
+      uint8_t  reserved2[12];
+      uint32_t trail_sig;     // FSINFO_TRAIL_SIG
+    } __attribute__((packed));
+    static const uint32_t FSINFO_LEAD_SIG   = 0x41615252;
+    static const uint32_t FSINFO_STRUCT_SIG = 0x61417272;
+    static const uint32_t FSINFO_TRAIL_SIG  = 0xAA550000;
+    static const uint32_t FSINFO_UNKNOWN    = 0xFFFFFFFF;
+    // keep the counters of the FSInfo sector @data, if they are sane
+    void load_fsinfo(const void* data);
+    
+    /// FAT scan ///
+    // bytes of FAT per device request, and the least a thread gets
+    static const uint32_t SCAN_CHUNK      = 1 << 20;
+    static const uint32_t SCAN_THREAD_MIN = 4 << 20;
+    // count the FAT32 entries in FAT sectors [@begin, @end)
+    error_t scan_range(uint32_t begin, uint32_t end, scan_counts_t&);
+    // drop all cached FAT sectors, chains and directory entries
+    void clear_caches();
+    // read the directory at @cluster a cluster at a time, passing on
+    // each sector until @on_sector returns true or there are no more
+    typedef std::function<bool(uint32_t sector, const uint8_t* data)> on_dir_sector_func;
+    void    dir_scan(uint32_t cluster, on_dir_sector_func on_sector, on_mount_func on_done);
+    error_t dir_scan(uint32_t cluster, const on_dir_sector_func& on_sector);
+    
+    // hint the device to fetch the FAT sector where the chain at
+    // @cluster starts, and after the first cluster of the directory,
+    // the rest of its clusters (up to DIR_PREFETCH_MAX sectors) as far
+    // as the chain is known without reading the FAT
+    static const uint32_t DIR_PREFETCH_MAX = 128;
+    void fat_prefetch(uint32_t cluster);
+    void dir_prefetch(uint32_t cluster);
+    
+    // longest name that fits in a chain of long name entries
+    static const int LONGNAME_MAX = 20 * 13;
+    // decodes directory entries, keeping long names across sectors
+    struct dir_decoder
+    {
+      uint8_t  lfn_next = 0;     // index of the expected long name entry
+      bool     lfn_done = false; // long name ready for the short entry
+      uint16_t lfn_len  = 0;
+      char     name[LONGNAME_MAX];
+      
+      // forget the long name being decoded
+      void reset()
+      {
+        lfn_next = 0;
+        lfn_done = false;
+      }
+    };
+    // the kinds of up to 64 consecutive directory entries, a bit each
+    struct dir_masks_t
+    {
+      uint64_t end;       // the end of directory marker
+      uint64_t deleted;   // unused entries
+      uint64_t longname;  // parts of long names
+      uint64_t shortname; // files, directories and labels
+    };
+    // classify the @count (at most 64) entries at @data all at once,
+    // with SSE2 or AVX2 when the CPU has them
+    static void dir_classify(const void* data, int count, dir_masks_t&);
+    // decode a part of a long name
+    void dir_longname(dir_decoder&, const cl_long&);
+    // the name of a short entry, or the long name that came before it
+    void dir_shortname(dir_decoder&, const cl_dir&, const char*& name, int& len);
+    // calls @func(entry, name, len) for every entry in the sector @data
+    // until @func returns true, returns true when the scan is done
+    template <typename Func>
+    bool dir_decode(dir_decoder&, const void* data, Func func);
+    
+    // sync cursor, reading one directory cluster at a time
+    struct dir_cursor : public DirCursor
+    {
+      dir_cursor(FAT& f, uint32_t cl)
+        : fs(f), start(f.cl_normalize(cl)), cluster(start) {}
+      
+      virtual bool next(DirentView& ent) override;
+      virtual error_t error() const override
+      { return failed; }
+      
+      FAT&     fs;
+      uint32_t start;
+      uint32_t cluster;
+      uint32_t index  = 0;
+      uint32_t sector = 0;
+      uint32_t count  = 0;  // sectors in @data
+      int      entry  = -1; // next group of entries in @data, -1 before the first read
+      int      group  = 0;  // the group being decoded
+      uint32_t visited = 1; // clusters of the chain read
+      dir_masks_t masks {};
+      uint64_t todo    = 0; // entries of the group left to decode
+      uint64_t pending = 0; // deleted entries of the group not passed yet
+      bool     done   = false;
+      bool     failed = false;
+      buffer_t data;
+      dir_decoder decoder;
+    };
+    
     // return a list of entries from directory entries at @sector
     typedef std::function<void(error_t, dirvec_t)> on_internal_ls_func;
-    void int_ls(uint32_t sector, dirvec_t, on_internal_ls_func);
-    bool int_dirent(uint32_t sector, const void* data, dirvec_t);
+    void int_ls(uint32_t cluster, dirvec_t, on_internal_ls_func);
+    bool int_dirent(dir_decoder&, uint32_t sector, const void* data, dirvec_t);
+    // look for @name in the sector @data, returns true when done
+    bool int_find(dir_decoder&, uint32_t sector, const void* data,
+                  const std::string& name, Dirent& found);
     
     // tree traversal
     typedef std::function<void(error_t, dirvec_t)> cluster_func;
     // async tree traversal
-    void traverse(std::shared_ptr<Path> path, cluster_func callback);
+    void traverse(const std::string& path, cluster_func callback);
     // sync version
-    error_t traverse(Path path, dirvec_t);
-    error_t int_ls(uint32_t sector, dirvec_t);
+    error_t int_ls(uint32_t cluster, dirvec_t);
+    
+    // path lookup, through the directory entry cache
+    typedef std::function<void(error_t, const Dirent&)> on_lookup_func;
+    typedef std::function<void(error_t, uint32_t)> on_walk_func;
+    // scan the directory at @cluster until @name is found,
+    // errors are I/O errors, @found is invalid if there is no @name
+    void    int_find(uint32_t cluster, const std::string& name, on_lookup_func);
+    error_t int_find(uint32_t cluster, const std::string& name, Dirent& found);
+    // find @name in the directory at @cluster
+    void    lookup(uint32_t cluster, const std::string& name, on_lookup_func);
+    error_t lookup(uint32_t cluster, const std::string& name, Dirent&);
+    // follow the directories in @path to the cluster of the last one
+    void    walk(const std::string& path, on_walk_func);
+    error_t walk(Path path, uint32_t& cluster);
+    // find the entry at the end of @path
+    void    resolve(const std::string& path, on_lookup_func);
+    
+    /// async path resolution ///
+    // the state of one async walk or resolve: every temporary needed
+    // to look up the path lives here, so the steps and sector reads
+    // only have to carry a pointer to it
+    struct path_op
+    {
+      Path           path;
+      on_walk_func   on_walk;  // set when walking to a directory
+      on_lookup_func on_found; // set when resolving an entry
+      uint32_t       dir;      // directory being searched
+      uint32_t       cluster;  // position in the directory
+      uint32_t       index;
+      uint32_t       visited;  // clusters of the directory scanned
+      uint32_t       sector;
+      uint32_t       count;    // sectors being read
+      std::string    name;     // component being looked up
+      dir_decoder    decoder;
+      Dirent         found;
+    };
+    // operations are recycled, so that steady-state lookups
+    // don't allocate their state
+    static const size_t PATH_OP_POOL = 16;
+    
+    path_op* op_acquire(const std::string& path);
+    void     op_release(path_op*);
+    // look up the next component, or finish
+    void op_step(path_op*);
+    // read the next cluster of the directory being searched
+    void op_scan(path_op*);
+    // enter @op->found, returns false if the operation finished
+    bool op_enter(path_op*);
+    void op_finish(path_op*, error_t);
+    
+    std::vector<std::unique_ptr<path_op>> op_pool;
+    std::mutex op_pool_mtx;
+    
+    /// directory name index ///
+    struct dir_index_t
+    {
+      dirvec_t ents;
+      std::unordered_map<std::string, size_t> names;
+    };
+    // smallest directory worth indexing, and how many to keep
+    static const size_t DIR_INDEX_MIN = 64;
+    static const size_t DIR_INDEX_MAX = 64;
+    
+    // returns true if the directory at @cluster is indexed,
+    // and sets @found to the entry for @name (invalid if none)
+    bool dir_index_lookup(uint32_t cluster, const std::string& name, Dirent& found);
+    // find @name in the listing @ents of the directory at @cluster,
+    // indexing the listing if enabled and the directory is large
+    Dirent dir_find(uint32_t cluster, dirvec_t ents, const std::string& name);
+    
+    std::atomic<bool> dir_index_enabled {false};
+    std::unordered_map<uint32_t, std::shared_ptr<const dir_index_t>> dir_indexes;
+    std::mutex dir_index_mtx;
     
     // device we can read and write sectors to
     hw::IDiskDevice& device;
+    // resolved names, by parent directory cluster
+    DentryCache dcache;
+    // buffers handed out by read() and readFile()
+    BufferPool  pool;
     
     /// private members ///
     // the location of this partition
@@ -199,6 +567,7 @@ namespace fs
     uint32_t lba_size;
     
     uint16_t sector_size; // from bytes_per_sector
+    uint16_t blocks_per_sector; // device blocks in a sector
     uint32_t sectors;   // total sectors in partition
     uint32_t clusters;  // number of indexable FAT clusters
     
@@ -210,6 +579,9 @@ namespace fs
     uint16_t root_dir_sectors; // FAT16 root entries
     
     uint32_t root_cluster;  // index of root cluster
+    uint16_t fsinfo_sector = 0; // FAT32 FSInfo sector, 0 if there is none
+    std::atomic<uint32_t> free_clusters {FSINFO_UNKNOWN}; // from FSInfo or a scan
+    uint32_t next_free = 0; // from FSInfo, 0 if unknown
     uint32_t data_index;    // index of first data sector (relative to partition)
     uint32_t data_sectors;  // number of data sectors
   };
@@ -0,0 +1,483 @@
+#include <fs/fat.hpp>
+#include <fs/simd.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace fs
+{
+  void FAT::dir_longname(dir_decoder& dec, const cl_long& L)
+  {
+    int idx = L.long_index();
+    
+    // the last long index starts a chain of entries
+    if (L.is_last())
+    {
+      dec.lfn_next = idx;
+      dec.lfn_len  = 0;
+    }
+    // ignore broken or too long chains
+    if (unlikely(idx != dec.lfn_next || idx < 1 || idx > LONGNAME_MAX / 13))
+    {
+      dec.reset();
+      return;
+    }
+    
+    uint16_t longname[13];
+    memcpy(longname+ 0, L.first, 10);
+    memcpy(longname+ 5, L.second, 12);
+    memcpy(longname+11, L.third, 4);
+    
+    char* dest = dec.name + (idx-1) * 13;
+    int j = 0;
+    for (; j < 13; j++)
+    {
+      // 0xFFFF and 0x0 indicate end of name
+      if (unlikely(longname[j] == 0xFFFF || longname[j] == 0x0)) break;
+      dest[j] = longname[j] & 0xFF;
+    }
+    if (L.is_last())
+        dec.lfn_len = (idx-1) * 13 + j;
+    
+    dec.lfn_next--;
+    dec.lfn_done = (dec.lfn_next == 0);
+  }
+  
+  void FAT::dir_shortname(
+      dir_decoder& dec, const cl_dir& D, const char*& name, int& len)
+  {
+    // the short entry has the stats and cluster,
+    // and the name unless there was a long name before it
+    name = (const char*) D.shortname;
+    len  = 11;
+    if (dec.lfn_done)
+    {
+      name = dec.name;
+      len  = dec.lfn_len;
+    }
+    dec.reset();
+    
+    while (len > 0 && isspace((unsigned char) name[len-1])) len--;
+  }
+  
+  namespace
+  {
+    // entries up to the first end marker
+    inline uint64_t before_end(uint64_t end)
+    {
+      return end ? (end & -end) - 1 : ~0ull;
+    }
+    
+    // sets a bit for each of the @count entries at @data starting with
+    // the end marker (0x00), the deleted marker (0xE5), or with the long
+    // name attributes, which are the top byte of the third dword
+    typedef void (*classify_func)(const uint8_t* data, int count,
+        uint64_t& end, uint64_t& deleted, uint64_t& lfn);
+    
+    void classify_scalar(const uint8_t* data, int count,
+        uint64_t& end, uint64_t& deleted, uint64_t& lfn)
+    {
+      end = deleted = lfn = 0;
+      for (int i = 0; i < count; i++)
+      {
+        const uint8_t* E = data + i * 32;
+        end     |= (uint64_t) (E[0] == 0x0)  << i;
+        deleted |= (uint64_t) (E[0] == 0xE5) << i;
+        lfn     |= (uint64_t) ((E[11] & 0x0F) == 0x0F) << i;
+      }
+    }
+    
+#ifdef FS_SIMD_X86
+    // the entries from @i that don't fill a vector
+    inline void classify_tail(const uint8_t* data, int i, int count,
+        uint64_t& end, uint64_t& deleted, uint64_t& lfn)
+    {
+      if (i == count) return;
+      uint64_t tend, tdel, tlfn;
+      classify_scalar(data + i * 32, count - i, tend, tdel, tlfn);
+      end     |= tend << i;
+      deleted |= tdel << i;
+      lfn     |= tlfn << i;
+    }
+    
+    __attribute__((target("sse2")))
+    void classify_sse2(const uint8_t* data, int count,
+        uint64_t& end, uint64_t& deleted, uint64_t& lfn)
+    {
+      const __m128i zero  = _mm_setzero_si128();
+      const __m128i first = _mm_set1_epi32(0xFF);
+      const __m128i e5    = _mm_set1_epi32(0xE5);
+      const __m128i attr  = _mm_set1_epi32(0x0F000000);
+      
+      int i = 0;
+      uint64_t mend = 0, mdel = 0, mlfn = 0;
+      for (; i + 4 <= count; i += 4)
+      {
+        // gather dword 0 and 2 of 4 entries
+        const uint8_t* E = data + i * 32;
+        __m128i e0 = _mm_loadu_si128((const __m128i*) (E + 0));
+        __m128i e1 = _mm_loadu_si128((const __m128i*) (E + 32));
+        __m128i e2 = _mm_loadu_si128((const __m128i*) (E + 64));
+        __m128i e3 = _mm_loadu_si128((const __m128i*) (E + 96));
+        __m128i lo01 = _mm_unpacklo_epi32(e0, e1);
+        __m128i lo23 = _mm_unpacklo_epi32(e2, e3);
+        __m128i hi01 = _mm_unpackhi_epi32(e0, e1);
+        __m128i hi23 = _mm_unpackhi_epi32(e2, e3);
+        __m128i dw0 = _mm_and_si128(_mm_unpacklo_epi64(lo01, lo23), first);
+        __m128i dw2 = _mm_and_si128(_mm_unpacklo_epi64(hi01, hi23), attr);
+        
+        mend |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(dw0, zero))) << i;
+        mdel |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(dw0, e5))) << i;
+        mlfn |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(dw2, attr))) << i;
+      }
+      end = mend; deleted = mdel; lfn = mlfn;
+      classify_tail(data, i, count, end, deleted, lfn);
+    }
+    
+    __attribute__((target("avx2")))
+    void classify_avx2(const uint8_t* data, int count,
+        uint64_t& end, uint64_t& deleted, uint64_t& lfn)
+    {
+      const __m256i zero  = _mm256_setzero_si256();
+      const __m256i first = _mm256_set1_epi32(0xFF);
+      const __m256i e5    = _mm256_set1_epi32(0xE5);
+      const __m256i attr  = _mm256_set1_epi32(0x0F000000);
+      // one entry is 8 dwords
+      const __m256i index = _mm256_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56);
+      
+      int i = 0;
+      uint64_t mend = 0, mdel = 0, mlfn = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+        const int* E = (const int*) (data + i * 32);
+        __m256i dw0 = _mm256_and_si256(_mm256_i32gather_epi32(E, index, 4), first);
+        __m256i dw2 = _mm256_and_si256(_mm256_i32gather_epi32(E + 2, index, 4), attr);
+        
+        mend |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(dw0, zero))) << i;
+        mdel |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(dw0, e5))) << i;
+        mlfn |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(dw2, attr))) << i;
+      }
+      end = mend; deleted = mdel; lfn = mlfn;
+      classify_tail(data, i, count, end, deleted, lfn);
+    }
+#endif
+    
+    // the widest version this CPU can run
+    const classify_func classify_entries =
+        FS_SIMD_SELECT(classify_scalar, classify_sse2, classify_avx2);
+  }
+  
+  void FAT::dir_classify(const void* data, int count, dir_masks_t& m)
+  {
+    uint64_t end, deleted, lfn;
+    classify_entries((const uint8_t*) data, count, end, deleted, lfn);
+    
+    // the first byte decides before the attributes do
+    const uint64_t valid = (count < 64) ? (1ull << count) - 1 : ~0ull;
+    m.end       = end & valid;
+    m.deleted   = deleted & valid;
+    m.longname  = lfn & ~(end | deleted) & valid;
+    m.shortname = valid & ~(end | deleted | lfn);
+  }
+  
+  template <typename Func>
+  bool FAT::dir_decode(dir_decoder& dec, const void* data, Func func)
+  {
+    auto* root = (const cl_dir*) data;
+    const int count = this->sector_size / sizeof(cl_dir);
+    
+    for (int base = 0; base < count; base += 64)
+    {
+      dir_masks_t m;
+      dir_classify(root + base, std::min(count - base, 64), m);
+      const uint64_t valid = before_end(m.end);
+      
+      // only live entries are decoded, the deleted ones between
+      // them just break up long names
+      uint64_t todo    = (m.longname | m.shortname) & valid;
+      uint64_t pending = m.deleted & valid;
+      while (todo)
+      {
+        const int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+        const uint64_t below = (1ull << i) - 1;
+        if (pending & below) dec.reset();
+        pending &= ~below;
+        
+        const auto& D = root[base + i];
+        if ((m.longname >> i) & 1)
+        {
+          dir_longname(dec, (const cl_long&) D);
+          continue;
+        }
+        const char* name;
+        int len;
+        dir_shortname(dec, D, name, len);
+        if (func(D, name, len)) return true;
+      }
+      if (pending) dec.reset();
+      if (m.end) return true;
+    }
+    return false;
+  }
+  
+  bool FAT::dir_cursor::next(DirentView& ent)
+  {
+    const int per_sector = fs.sector_size / sizeof(cl_dir);
+    
+    while (!done)
+    {
+      if (todo == 0)
+      {
+        // the group is done, and maybe the directory
+        if (pending) decoder.reset();
+        if (masks.end)
+        {
+          done = true;
+          break;
+        }
+        
+        if (entry < 0 || entry == (int) count * per_sector)
+        {
+          // read the first cluster, or move on to the next one
+          if (entry < 0)
+          {
+            fs.fat_prefetch(cluster);
+          }
+          else
+          {
+            // there is more: start fetching the rest of the directory
+            if (cluster == start && index == 0)
+                fs.dir_prefetch(start);
+            if (!fs.next_chunk(cluster, index, count, visited))
+            {
+              // a broken chain is an error, its end is not
+              done = true;
+              failed = (cluster == CL_BAD);
+              break;
+            }
+          }
+          sector = fs.cl_to_sector(cluster) + index;
+          count  = fs.cl_chunk(cluster, index);
+          data   = fs.read_sectors(sector, count);
+          if (unlikely(!data))
+          {
+            done = failed = true;
+            break;
+          }
+          entry = 0;
+        }
+        
+        // classify the next group of entries
+        const int n = std::min((int) count * per_sector - entry, 64);
+        group = entry;
+        entry += n;
+        dir_classify(data.get() + group * sizeof(cl_dir), n, masks);
+        const uint64_t valid = before_end(masks.end);
+        todo    = (masks.longname | masks.shortname) & valid;
+        pending = masks.deleted & valid;
+        continue;
+      }
+      
+      const int i = __builtin_ctzll(todo);
+      todo &= todo - 1;
+      const uint64_t below = (1ull << i) - 1;
+      if (pending & below) decoder.reset();
+      pending &= ~below;
+      
+      const int e = group + i;
+      const auto& D = ((const cl_dir*) data.get())[e];
+      if ((masks.longname >> i) & 1)
+      {
+        fs.dir_longname(decoder, (const cl_long&) D);
+        continue;
+      }
+      const char* name;
+      int len;
+      fs.dir_shortname(decoder, D, name, len);
+      
+      ent.ftype     = D.type();
+      ent.fname     = name;
+      ent.fname_len = len;
+      ent.block     = D.dir_cluster(fs.cl_normalize(0));
+      ent.parent    = fs.sector_to_block(sector + e / per_sector); // parent block
+      ent.size      = D.size();
+      ent.attrib    = D.attrib;
+      return true;
+    }
+    // nothing more to read
+    data = nullptr;
+    return false;
+  }
+  
+  bool FAT::int_dirent(
+      dir_decoder& dec,
+      uint32_t  sector,
+      const void* data, 
+      dirvec_t dirents)
+  {
+    return dir_decode(dec, data,
+    [this, sector, &dirents] (const cl_dir& D, const char* name, int len)
+    {
+      dirents->emplace_back(
+        D.type(), 
+        std::string(name, len), 
+        D.dir_cluster(cl_normalize(0)), 
+        sector_to_block(sector), // parent block
+        D.size(), 
+        D.attrib);
+      return false;
+    });
+  }
+  
+  bool FAT::int_find(
+      dir_decoder& dec,
+      uint32_t  sector,
+      const void* data,
+      const std::string& name,
+      Dirent& found)
+  {
+    return dir_decode(dec, data,
+    [this, sector, &name, &found] (const cl_dir& D, const char* dname, int len)
+    {
+      if (likely((size_t) len != name.size() || memcmp(dname, name.data(), len)))
+          return false;
+      
+      found = Dirent(
+        D.type(), 
+        name, 
+        D.dir_cluster(cl_normalize(0)), 
+        sector_to_block(sector), // parent block
+        D.size(), 
+        D.attrib);
+      return true;
+    });
+  }
+  
+  void FAT::fat_prefetch(uint32_t cluster)
+  {
+    // the root directory of FAT12/16 is not a chain
+    if (cluster == 0) return;
+    prefetch_sectors(cl_to_entry_sector(cluster), 1);
+  }
+  
+  void FAT::dir_prefetch(uint32_t cluster)
+  {
+    if (cluster == 0)
+    {
+      // fixed area right before the data clusters, read in chunks
+      uint32_t index  = 0;
+      uint32_t budget = DIR_PREFETCH_MAX;
+      uint32_t visited = 1;
+      while (next_chunk(cluster, index, cl_chunk(0, index), visited) && budget)
+      {
+        uint32_t count = cl_chunk(0, index);
+        if (count > budget) break;
+        prefetch_sectors(cl_to_sector(0) + index, count);
+        budget -= count;
+      }
+      return;
+    }
+    
+    // this runs on the read path, so the chain must be known
+    // without reading the FAT: as an extent map built before,
+    // or from FAT sectors that are cached
+    extents_t map;
+    {
+      std::lock_guard<std::mutex> lock(extent_cache_mtx);
+      auto it = extent_cache.find(cluster);
+      if (it != extent_cache.end())
+          map = it->second;
+    }
+    
+    // one hint per cluster, the way they are read, skipping the first
+    uint32_t budget = DIR_PREFETCH_MAX;
+    if (map)
+    {
+      for (const auto& run : *map)
+      {
+        for (uint32_t i = (run.offset == 0) ? 1 : 0; i < run.count; i++)
+        {
+          if (budget < this->sectors_per_cluster) return;
+          prefetch_sectors(cl_to_sector(run.cluster + i), this->sectors_per_cluster);
+          budget -= this->sectors_per_cluster;
+        }
+      }
+      return;
+    }
+    
+    uint32_t cl = cluster;
+    while (budget >= this->sectors_per_cluster)
+    {
+      uint32_t next = cl_next(cl, false);
+      if (next == CL_FREE)
+      {
+        // the rest of the chain is in a FAT sector that isn't cached,
+        // fetch it instead and leave the clusters to a later pass
+        fat_prefetch(cl);
+        return;
+      }
+      if (cl_is_end(next)) return;
+      cl = next;
+      prefetch_sectors(cl_to_sector(cl), this->sectors_per_cluster);
+      budget -= this->sectors_per_cluster;
+    }
+  }
+  
+  void FAT::enable_dir_index(bool enabled)
+  {
+    this->dir_index_enabled = enabled;
+    if (enabled) return;
+    
+    std::lock_guard<std::mutex> lock(dir_index_mtx);
+    dir_indexes.clear();
+  }
+  
+  bool FAT::dir_index_lookup(uint32_t cluster, const std::string& name, Dirent& found)
+  {
+    std::shared_ptr<const dir_index_t> index;
+    {
+      std::lock_guard<std::mutex> lock(dir_index_mtx);
+      auto it = dir_indexes.find(cl_normalize(cluster));
+      if (it == dir_indexes.end()) return false;
+      index = it->second;
+    }
+    
+    auto it = index->names.find(name);
+    if (it != index->names.end())
+        found = (*index->ents)[it->second];
+    else
+        found = Dirent(INVALID_ENTITY, name);
+    return true;
+  }
+  
+  FAT::Dirent FAT::dir_find(uint32_t cluster, dirvec_t ents, const std::string& name)
+  {
+    if (!dir_index_enabled || ents->size() < DIR_INDEX_MIN)
+    {
+      // small directories are faster to search directly
+      for (auto& e : *ents)
+      if (unlikely(e.name() == name))
+          return e;
+      return Dirent(INVALID_ENTITY, name);
+    }
+    
+    auto index = std::make_shared<dir_index_t> ();
+    index->ents = ents;
+    index->names.reserve(ents->size());
+    for (size_t i = 0; i < ents->size(); i++)
+        index->names.emplace((*ents)[i].name(), i);
+    
+    Dirent found(INVALID_ENTITY, name);
+    auto it = index->names.find(name);
+    if (it != index->names.end())
+        found = (*ents)[it->second];
+    
+    std::lock_guard<std::mutex> lock(dir_index_mtx);
+    if (dir_indexes.size() >= DIR_INDEX_MAX)
+        dir_indexes.clear();
+    dir_indexes[cl_normalize(cluster)] = index;
+    return found;
+  }
+}
@@ -0,0 +1,133 @@
+#include <fs/fat.hpp>
+
+#include <algorithm>
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+namespace fs
+{
+  void FAT::enable_readahead(bool enabled)
+  {
+    this->readahead_enabled = enabled;
+    if (enabled) return;
+    
+    std::lock_guard<std::mutex> lock(stream_mtx);
+    for (auto& s : streams)
+        s = stream_t();
+  }
+  
+  uint32_t FAT::ra_access(uint32_t file, uint64_t pos, uint64_t n,
+                          buffer_t& ahead, uint64_t& ahead_pos)
+  {
+    std::lock_guard<std::mutex> lock(stream_mtx);
+    
+    // find the stream of this file, or replace the oldest one
+    stream_t* s = nullptr;
+    stream_t* oldest = &streams[0];
+    for (auto& st : streams)
+    {
+      if (st.file == file)
+      {
+        s = &st;
+        break;
+      }
+      if (st.last < oldest->last) oldest = &st;
+    }
+    if (s == nullptr)
+    {
+      s = oldest;
+      *s = stream_t();
+      s->file = file;
+    }
+    s->last = ++stream_clock;
+    
+    // the window doubles for every sequential read,
+    // and closes on the first read elsewhere
+    if (pos == s->next)
+      s->window = s->window ? std::min(s->window * 2, READ_MAX_SECTORS) : RA_MIN_SECTORS;
+    else
+      s->window = 0;
+    s->next = pos + n;
+    
+    ahead     = s->ahead;
+    ahead_pos = s->ahead_pos;
+    return s->window;
+  }
+  
+  void FAT::ra_store(uint32_t file, uint64_t pos, buffer_t data)
+  {
+    std::lock_guard<std::mutex> lock(stream_mtx);
+    for (auto& s : streams)
+    if (s.file == file)
+    {
+      s.ahead     = std::move(data);
+      s.ahead_pos = pos;
+      return;
+    }
+  }
+  
+  void FAT::ra_prefetch(const Dirent& ent, uint64_t pos, uint32_t window)
+  {
+    if (pos >= ent.size) return;
+    const uint32_t file = ent.block;
+    // read whole sectors
+    pos -= pos % this->sector_size;
+    {
+      std::lock_guard<std::mutex> lock(stream_mtx);
+      auto s = std::find_if(std::begin(streams), std::end(streams),
+               [file] (const stream_t& st) { return st.file == file; });
+      if (s == std::end(streams) || s->pending) return;
+      // still reading what is there
+      if (s->ahead && pos >= s->ahead_pos && pos < s->ahead_pos + s->ahead.size())
+          return;
+      s->pending     = true;
+      s->pending_pos = pos;
+    }
+    
+    // read ahead within the run containing @pos
+    const uint64_t cluster_size = this->sector_size * this->sectors_per_cluster;
+    uint32_t count = 0;
+    uint32_t sector = 0;
+    auto map = extents(ent.block);
+    if (likely(map))
+    {
+      uint32_t offset = pos / cluster_size;
+      auto ext = extent_find(*map, offset);
+      if (likely(ext != map->end()))
+      {
+        uint32_t index = (pos % cluster_size) / this->sector_size;
+        uint32_t run   = (ext->offset + ext->count - offset) * this->sectors_per_cluster - index;
+        uint64_t file_left = (ent.size - pos + this->sector_size - 1) / this->sector_size;
+        sector = this->cl_to_sector(ext->cluster + (offset - ext->offset)) + index;
+        count  = std::min<uint64_t>(window, file_left);
+        count  = std::min(count, run);
+      }
+    }
+    
+    if (unlikely(count == 0))
+    {
+      std::lock_guard<std::mutex> lock(stream_mtx);
+      for (auto& s : streams)
+        if (s.file == file) s.pending = false;
+      return;
+    }
+    
+    read_sectors(sector, count,
+    [this, file] (buffer_t data)
+    {
+      std::lock_guard<std::mutex> lock(stream_mtx);
+      for (auto& s : streams)
+      if (s.file == file && s.pending)
+      {
+        s.pending = false;
+        if (data)
+        {
+          s.ahead     = std::move(data);
+          s.ahead_pos = s.pending_pos;
+        }
+        return;
+      }
+    });
+  }
+}
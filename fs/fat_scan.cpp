@@ -0,0 +1,227 @@
+#include <fs/fat.hpp>
+#include <fs/simd.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace fs
+{
+  namespace
+  {
+    typedef FAT::buffer_t buffer_t;
+    typedef FAT::scan_counts_t scan_counts_t;
+    
+    // FAT32 entry values, the top 4 bits are reserved
+    const uint32_t ENTRY_MASK = 0x0FFFFFFF;
+    const uint32_t ENTRY_BAD  = 0x0FFFFFF7;
+    
+    // count the @n FAT32 entries at @data, for the clusters from @first,
+    // returns how many were counted (the vector versions leave a tail)
+    typedef uint32_t (*count_func)(const uint8_t* data, uint32_t first, uint32_t n, scan_counts_t&);
+    
+    uint32_t count_scalar(const uint8_t* data, uint32_t first, uint32_t n, scan_counts_t& c)
+    {
+      for (uint32_t i = 0; i < n; i++)
+      {
+        uint32_t value;
+        memcpy(&value, data + i * 4, sizeof(value));
+        value &= ENTRY_MASK;
+        c.free   += (value == 0);
+        c.bad    += (value == ENTRY_BAD);
+        c.linked += (value == first + i + 1);
+      }
+      return n;
+    }
+    
+#ifdef FS_SIMD_X86
+    // matching lanes are all ones, so subtracting a compare counts them
+    __attribute__((target("sse2")))
+    uint32_t count_sse2(const uint8_t* data, uint32_t first, uint32_t n, scan_counts_t& c)
+    {
+      const __m128i mask = _mm_set1_epi32(ENTRY_MASK);
+      const __m128i bad  = _mm_set1_epi32(ENTRY_BAD);
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i step = _mm_set1_epi32(4);
+      __m128i next = _mm_setr_epi32(first + 1, first + 2, first + 3, first + 4);
+      __m128i nfree = zero, nbad = zero, nlinked = zero;
+      
+      uint32_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i * 4));
+        v = _mm_and_si128(v, mask);
+        nfree   = _mm_sub_epi32(nfree,   _mm_cmpeq_epi32(v, zero));
+        nbad    = _mm_sub_epi32(nbad,    _mm_cmpeq_epi32(v, bad));
+        nlinked = _mm_sub_epi32(nlinked, _mm_cmpeq_epi32(v, next));
+        next = _mm_add_epi32(next, step);
+      }
+      
+      uint32_t lanes[3][4];
+      _mm_storeu_si128((__m128i*) lanes[0], nfree);
+      _mm_storeu_si128((__m128i*) lanes[1], nbad);
+      _mm_storeu_si128((__m128i*) lanes[2], nlinked);
+      for (int l = 0; l < 4; l++)
+      {
+        c.free   += lanes[0][l];
+        c.bad    += lanes[1][l];
+        c.linked += lanes[2][l];
+      }
+      return i;
+    }
+    
+    __attribute__((target("avx2")))
+    uint32_t count_avx2(const uint8_t* data, uint32_t first, uint32_t n, scan_counts_t& c)
+    {
+      const __m256i mask = _mm256_set1_epi32(ENTRY_MASK);
+      const __m256i bad  = _mm256_set1_epi32(ENTRY_BAD);
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i step = _mm256_set1_epi32(8);
+      __m256i next = _mm256_setr_epi32(first + 1, first + 2, first + 3, first + 4,
+                                       first + 5, first + 6, first + 7, first + 8);
+      __m256i nfree = zero, nbad = zero, nlinked = zero;
+      
+      uint32_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i * 4));
+        v = _mm256_and_si256(v, mask);
+        nfree   = _mm256_sub_epi32(nfree,   _mm256_cmpeq_epi32(v, zero));
+        nbad    = _mm256_sub_epi32(nbad,    _mm256_cmpeq_epi32(v, bad));
+        nlinked = _mm256_sub_epi32(nlinked, _mm256_cmpeq_epi32(v, next));
+        next = _mm256_add_epi32(next, step);
+      }
+      
+      uint32_t lanes[3][8];
+      _mm256_storeu_si256((__m256i*) lanes[0], nfree);
+      _mm256_storeu_si256((__m256i*) lanes[1], nbad);
+      _mm256_storeu_si256((__m256i*) lanes[2], nlinked);
+      for (int l = 0; l < 8; l++)
+      {
+        c.free   += lanes[0][l];
+        c.bad    += lanes[1][l];
+        c.linked += lanes[2][l];
+      }
+      return i;
+    }
+#endif
+    
+    // the widest version this CPU can run
+    const count_func count_entries =
+        FS_SIMD_SELECT(count_scalar, count_sse2, count_avx2);
+  }
+  
+  error_t FAT::scan_range(uint32_t begin, uint32_t end, scan_counts_t& result)
+  {
+    const uint32_t per_sector = this->sector_size / 4;
+    const uint32_t chunk = SCAN_CHUNK / this->sector_size;
+    const uint64_t last  = (uint64_t) this->clusters + 2;
+    result = scan_counts_t();
+    
+    for (uint32_t sector = begin; sector < end; sector += chunk)
+    {
+      const uint32_t count = std::min(chunk, end - sector);
+      // the table is bulk data, larger than what caches keep
+      buffer_t data = read_sectors(this->reserved + sector, count);
+      if (unlikely(!data)) return true;
+      
+      // only the entries of data clusters count
+      const uint64_t first = (uint64_t) sector * per_sector;
+      const uint64_t lo = std::max<uint64_t>(first, 2);
+      const uint64_t hi = std::min<uint64_t>(first + count * per_sector, last);
+      if (lo >= hi) continue;
+      
+      const uint8_t* entries = data.get() + (lo - first) * 4;
+      const uint32_t n = hi - lo;
+      uint32_t done = count_entries(entries, lo, n, result);
+      count_scalar(entries + done * 4, lo + done, n - done, result);
+    }
+    return no_error;
+  }
+  
+  error_t FAT::scan_fat(fat_stats_t& stats, unsigned threads)
+  {
+    scan_counts_t total;
+    
+    if (this->fat_type == T_FAT32)
+    {
+      // the sectors holding the entries of every cluster
+      const uint64_t bytes   = ((uint64_t) this->clusters + 2) * 4;
+      const uint32_t sectors = (bytes + this->sector_size - 1) / this->sector_size;
+      
+      // split into ranges of whole requests, at least SCAN_THREAD_MIN each
+      if (threads == 0)
+          threads = std::max(1u, std::thread::hardware_concurrency());
+      const uint32_t chunk = SCAN_CHUNK / this->sector_size;
+      const uint64_t most  = std::max<uint64_t>(1, bytes / SCAN_THREAD_MIN);
+      threads = std::min<uint64_t>(threads, most);
+      uint32_t per_thread = (sectors + threads - 1) / threads;
+      per_thread = (per_thread + chunk - 1) / chunk * chunk;
+      
+      std::vector<scan_counts_t> counts(threads);
+      std::vector<char> failed(threads);
+      std::vector<std::thread> workers;
+      for (unsigned t = 0; t < threads; t++)
+      {
+        const uint32_t begin = std::min<uint64_t>((uint64_t) t * per_thread, sectors);
+        const uint32_t end   = std::min<uint64_t>((uint64_t) begin + per_thread, sectors);
+        auto work = [this, begin, end, t, &counts, &failed]
+        {
+          failed[t] = scan_range(begin, end, counts[t]);
+        };
+        // the last range is scanned here
+        if (t + 1 < threads)
+            workers.emplace_back(work);
+        else
+            work();
+      }
+      for (auto& w : workers) w.join();
+      
+      for (unsigned t = 0; t < threads; t++)
+      {
+        if (unlikely(failed[t])) return true;
+        total.free   += counts[t].free;
+        total.bad    += counts[t].bad;
+        total.linked += counts[t].linked;
+      }
+    }
+    else
+    {
+      // FAT12/16 tables are at most 128 KiB, read in one go
+      buffer_t data = read_sectors(this->reserved, this->sectors_per_fat);
+      if (unlikely(!data)) return true;
+      const uint8_t* fat = data.get();
+      
+      for (uint32_t cl = 2; cl < this->clusters + 2; cl++)
+      {
+        uint32_t value;
+        if (this->fat_type == T_FAT12)
+        {
+          uint32_t ofs = cl + cl / 2;
+          value = fat[ofs] | (fat[ofs + 1] << 8);
+          value = (cl & 1) ? (value >> 4) : (value & 0xFFF);
+          if (value == 0xFF7) value = CL_BAD;
+        }
+        else
+        {
+          value = fat[cl * 2] | (fat[cl * 2 + 1] << 8);
+          if (value == 0xFFF7) value = CL_BAD;
+        }
+        total.free   += (value == CL_FREE);
+        total.bad    += (value == CL_BAD);
+        total.linked += (value == cl + 1);
+      }
+    }
+    
+    stats.clusters  = this->clusters;
+    stats.free      = total.free;
+    stats.bad       = total.bad;
+    stats.used      = this->clusters - total.free - total.bad;
+    // every run ends in an entry that doesn't link to the next cluster
+    stats.fragments = stats.used - total.linked;
+    
+    this->free_clusters = stats.free;
+    return no_error;
+  }
+}
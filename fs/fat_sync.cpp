@@ -9,6 +9,7 @@
 #include <cstring>
 #include <memory>
 #include <locale>
+#include <algorithm>
 #include <kernel/syscalls.hpp> // for panic()
 
 #include <info>
@@ -27,132 +28,296 @@ namespace fs
 {
   typedef FileSystem::Buffer Buffer;
   
-  Buffer FAT::read(const Dirent& ent, uint64_t pos, uint64_t n)
+  template <typename Func>
+  error_t FAT::read_range(const Dirent& ent, uint64_t pos, uint64_t n, Func on_data)
   {
-    // cluster -> sector + position -> sector
-    uint32_t sector = this->cl_to_sector(ent.block) + pos / this->sector_size;
+    const uint64_t end = pos + n;
     
-    // the resulting buffer
-    uint8_t* result = new uint8_t[n];
+    // sequential readers are served from what was read ahead
+    uint32_t window = 0;
+    if (readahead_enabled && ent.block >= 2)
+    {
+      buffer_t ahead;
+      uint64_t ahead_pos;
+      window = ra_access(ent.block, pos, n, ahead, ahead_pos);
+      
+      if (ahead && pos >= ahead_pos && pos < ahead_pos + ahead.size())
+      {
+        uint64_t len = std::min<uint64_t>(n, ahead_pos + ahead.size() - pos);
+        on_data(ahead.slice(pos - ahead_pos, len));
+        pos += len;
+        n   -= len;
+        if (n == 0)
+        {
+          if (window) ra_prefetch(ent, end, window);
+          return no_error;
+        }
+      }
+    }
+    
+    const uint64_t cluster_size = this->sector_size * this->sectors_per_cluster;
+    const uint64_t file_sectors = (ent.size + this->sector_size - 1) / this->sector_size;
+    
+    // find the cluster run containing @pos
+    auto map = extents(ent.block);
+    if (unlikely(!map)) return true;
+    
+    uint32_t offset = pos / cluster_size;
+    auto ext = extent_find(*map, offset);
+    if (unlikely(ext == map->end())) return true;
     
-    // in all cases, read the first sector
-    buffer_t data = device.read_sync(sector);
+    // position -> sector, and the sectors left in this run
+    uint32_t index  = (pos % cluster_size) / this->sector_size;
+    uint32_t sector = this->cl_to_sector(ext->cluster + (offset - ext->offset)) + index;
+    uint32_t run    = (ext->offset + ext->count - offset) * this->sectors_per_cluster - index;
+    uint32_t internal_ofs = pos % this->sector_size;
+    // file position of @sector
+    uint64_t sector_pos = pos - internal_ofs;
     
-    uint32_t internal_ofs = pos % device.block_size();
     // keep track of total bytes
-    uint64_t total = n;
-    // calculate bytes to read before moving on to next sector
-    uint32_t rest = device.block_size() - (pos - internal_ofs);
+    uint64_t total = 0;
     
-    // if what we want to read is larger than the rest, exit early
-    if (rest > n)
+    while (true)
     {
-      memcpy(result, data.get() + internal_ofs, n);
+      // sectors left to read, limited by this run
+      uint64_t left = (internal_ofs + (n - total) + this->sector_size - 1) / this->sector_size;
+      uint32_t count = std::min<uint64_t>(left, run);
+      count = std::min(count, READ_MAX_SECTORS);
       
-      return Buffer(no_error, buffer_t(result), n);
-    }
-    // otherwise, read to the sector border
-    uint8_t* ptr = result;
-    memcpy(ptr, data.get() + internal_ofs, rest);
-    ptr += rest;
-    n   -= rest;
-    sector += 1;
-    
-    // copy entire sectors
-    while (n > device.block_size())
-    {
-      data = device.read_sync(sector);
+      // the last read of a sequential reader reads ahead in the same request
+      uint32_t extra = 0;
+      if (window && count == left)
+      {
+        uint64_t file_left = file_sectors - sector_pos / this->sector_size - count;
+        extra = std::min<uint64_t>(window, file_left);
+        extra = std::min(extra, run - count);
+        extra = std::min(extra, READ_MAX_SECTORS - count);
+      }
+      
+      buffer_t data = read_sectors(sector, count + extra);
+      if (unlikely(!data)) return true;
+      
+      // pass on until the end of the request, or the rest
+      uint64_t len = std::min<uint64_t>(count * this->sector_size - internal_ofs, n - total);
+      on_data(data.slice(internal_ofs, len));
+      if (extra)
+        ra_store(ent.block, sector_pos + count * this->sector_size,
+                 data.slice(count * this->sector_size));
+      total += len;
+      internal_ofs = 0;
       
-      memcpy(ptr, data.get(), device.block_size());
-      ptr += device.block_size();
-      n   -= device.block_size();
-      sector += 1;
+      if (total == n)
+      {
+        if (window) ra_prefetch(ent, end, window);
+        return no_error;
+      }
+      
+      // continue in this run, or go to the next run
+      run -= count;
+      sector_pos += count * this->sector_size;
+      if (run > 0)
+      {
+        sector += count;
+      }
+      else
+      {
+        // the chain ended early
+        if (unlikely(++ext == map->end())) return true;
+        sector = this->cl_to_sector(ext->cluster);
+        run    = ext->count * this->sectors_per_cluster;
+      }
     }
+  }
+  
+  Buffer FAT::read(const Dirent& ent, uint64_t pos, uint64_t n)
+  {
+    // nothing to read past the end of the file
+    if (unlikely(pos >= ent.size || n == 0))
+      return Buffer(no_error, buffer_t(), 0);
+    if (n > ent.size - pos)
+      n = ent.size - pos;
     
-    // copy remainder
-    if (likely(n > 0))
+    // the resulting buffer
+    buffer_t result;
+    uint64_t total = 0;
+    
+    auto err = read_range(ent, pos, n,
+    [this, n, &result, &total] (buffer_t data)
     {
-      data = device.read_sync(sector);
-      memcpy(ptr, data.get(), n);
-    }
+      if (data.size() == n)
+      {
+        // the whole range came in one read, share it instead of copying
+        result = std::move(data);
+      }
+      else
+      {
+        if (!result) result = pool.get(n);
+        memcpy(result.get() + total, data.get(), data.size());
+      }
+      total += data.size();
+    });
+    if (unlikely(err))
+      return Buffer(true, buffer_t(), 0);
+    
+    return Buffer(no_error, result, n);
+  }
+  
+  Buffer FAT::read(const Dirent& ent, uint64_t pos, buffer_t dest)
+  {
+    uint64_t n = dest.size();
+    if (unlikely(pos >= ent.size || n == 0))
+      return Buffer(no_error, dest.slice(0, 0), 0);
+    if (n > ent.size - pos)
+      n = ent.size - pos;
+    
+    uint64_t total = 0;
+    auto err = read_range(ent, pos, n,
+    [&dest, &total] (buffer_t data)
+    {
+      memcpy(dest.get() + total, data.get(), data.size());
+      total += data.size();
+    });
+    if (unlikely(err))
+      return Buffer(true, buffer_t(), 0);
+    
+    return Buffer(no_error, dest.slice(0, n), n);
+  }
+  
+  error_t FAT::readv(const Dirent& ent, uint64_t pos, uint64_t n, slices_t& out)
+  {
+    if (unlikely(pos >= ent.size || n == 0))
+      return no_error;
+    if (n > ent.size - pos)
+      n = ent.size - pos;
     
-    return Buffer(no_error, buffer_t(result), total);
+    const size_t start = out.size();
+    auto err = read_range(ent, pos, n,
+    [&out] (buffer_t data)
+    {
+      out.push_back(std::move(data));
+    });
+    // leave nothing behind on errors
+    if (unlikely(err))
+      out.resize(start);
+    
+    return err;
   }
   
-  error_t FAT::int_ls(uint32_t sector, dirvec_t ents)
+  error_t FAT::dir_scan(uint32_t cluster, const on_dir_sector_func& on_sector)
   {
-    bool done = false;
-    while (!done)
+    const uint32_t start = cl_normalize(cluster);
+    cluster = start;
+    uint32_t index = 0;
+    uint32_t visited = 1;
+    fat_prefetch(start);
+    while (true)
     {
-      // read sector sync
-      buffer_t data = device.read_sync(sector);
+      uint32_t sector = this->cl_to_sector(cluster) + index;
+      uint32_t count  = cl_chunk(cluster, index);
+      // read the cluster sync
+      buffer_t data = read_sectors(sector, count);
       if (!data) return true;
-      // parse directory into @ents
-      done = int_dirent(sector, data.get(), ents);
-      // go to next sector until done
-      sector++;
+      // parse directory entries sector by sector
+      bool done = false;
+      for (uint32_t i = 0; i < count && !done; i++)
+          done = on_sector(sector + i, data.get() + i * this->sector_size);
+      if (done) break;
+      // there is more: start fetching the rest of the directory
+      if (cluster == start && index == 0)
+          dir_prefetch(start);
+      // go to next cluster until done, a broken chain is an error
+      if (!next_chunk(cluster, index, count, visited))
+          return cluster == CL_BAD;
     }
+    
     return no_error;
   }
   
-  error_t FAT::traverse(Path path, dirvec_t ents)
+  error_t FAT::int_ls(uint32_t cluster, dirvec_t ents)
+  {
+    dir_decoder decoder;
+    return dir_scan(cluster,
+    [this, &decoder, &ents] (uint32_t sector, const uint8_t* data)
+    {
+      // parse directory into @ents
+      return int_dirent(decoder, sector, data, ents);
+    });
+  }
+  
+  error_t FAT::int_find(uint32_t cluster, const std::string& name, Dirent& found)
+  {
+    dir_decoder decoder;
+    found = Dirent(INVALID_ENTITY, name);
+    return dir_scan(cluster,
+    [this, &decoder, &name, &found] (uint32_t sector, const uint8_t* data)
+    {
+      return int_find(decoder, sector, data, name, found);
+    });
+  }
+  
+  error_t FAT::lookup(uint32_t cluster, const std::string& name, Dirent& found)
+  {
+    if (dcache.lookup(cl_normalize(cluster), name, found))
+      return !found.is_valid();
+    
+    if (!dir_index_enabled)
+    {
+      // stop reading at the first match
+      auto err = int_find(cluster, name, found);
+      if (unlikely(err)) return err;
+    }
+    else if (!dir_index_lookup(cluster, name, found))
+    {
+      // sync read entire directory
+      auto dirents = new_shared_vector();
+      auto err = int_ls(cluster, dirents);
+      if (unlikely(err)) return err;
+      
+      // check for matches in dirents
+      found = dir_find(cluster, dirents, name);
+    }
+    
+    dcache.insert(cl_normalize(cluster), name, found);
+    return !found.is_valid();
+  }
+  
+  error_t FAT::walk(Path path, uint32_t& cluster)
   {
     // start with root dir
-    uint32_t cluster = 0;
-    // directory entries are read into this
-    auto dirents = new_shared_vector();
-    Dirent found(INVALID_ENTITY);
+    cluster = 0;
     
     while (!path.empty())
     {
-      uint32_t S = this->cl_to_sector(cluster);
-      dirents->clear(); // mui importante
-      // sync read entire directory
-      auto err = int_ls(S, dirents);
-      if (err) return err;
       // the name we are looking for
       std::string name = path.front();
       path.pop_front();
       
-      // check for matches in dirents
-      for (auto& e : *dirents)
-      if (unlikely(e.name() == name))
-      {
-        // go to this directory, unless its the last name
-        debug("traverse_sync: Found match for %s", name.c_str());
-        // enter the matching directory
-        debug("\t\t cluster: %lu\n", e.block);
-        // only follow if the name is a directory
-        if (e.type() == DIR)
-        {
-          found = e;
-          break;
-        }
-        else
-        {
-          // not dir = error, for now
-          return true;
-        }
-      } // for (ents)
-      
-      // validate result
-      if (found.type() == INVALID_ENTITY)
+      Dirent found(INVALID_ENTITY);
+      if (lookup(cluster, name, found))
       {
         debug("traverse_sync: NO MATCH for %s\n", name.c_str());
         return true;
       }
-      // set next cluster
+      // only follow if the name is a directory
+      if (found.type() != DIR)
+      {
+        // not dir = error, for now
+        return true;
+      }
+      // enter the matching directory
+      debug("\t\t cluster: %lu\n", found.block);
       cluster = found.block;
     }
-    
-    uint32_t S = this->cl_to_sector(cluster);
-    // read result directory entries into ents
-    return int_ls(S, ents);
+    return no_error;
   }
   
-  error_t FAT::ls(const std::string& strpath, dirvec_t ents)
+  FileSystem::cursor_t FAT::begin(const std::string& strpath)
   {
-    return traverse(strpath, ents);
+    uint32_t cluster;
+    auto err = walk(strpath, cluster);
+    if (unlikely(err)) return nullptr;
+    
+    return cursor_t(new dir_cursor(*this, cluster));
   }
   
   FAT::Dirent FAT::stat(const std::string& strpath)
@@ -169,22 +334,13 @@ namespace fs
     std::string filename = path.back();
     path.pop_back();
     
-    // result directory entries are put into @dirents
-    auto dirents = std::make_shared<std::vector<Dirent>> ();
-    
-    auto err = traverse(path, dirents);
+    uint32_t cluster;
+    auto err = walk(path, cluster);
     if (err) return Dirent(INVALID_ENTITY); // for now
     
     // find the matching filename in directory
-    for (auto& e : *dirents)
-    {
-      if (unlikely(e.name() == filename))
-      {
-        // return this directory entry
-        return e;
-      }
-    }
-    // entry not found
-    return Dirent(INVALID_ENTITY);
+    Dirent found(INVALID_ENTITY);
+    lookup(cluster, filename, found);
+    return found;
   }
 }
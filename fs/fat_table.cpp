@@ -0,0 +1,158 @@
+#include <fs/fat.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+namespace fs
+{
+  FAT::buffer_t FAT::fat_sector(uint32_t sector, bool read)
+  {
+    auto& slot = fat_cache[sector % FAT_CACHE_SLOTS];
+    {
+      std::lock_guard<std::mutex> lock(fat_cache_mtx);
+      if (likely(slot.data && slot.sector == sector))
+          return slot.data;
+    }
+    if (!read) return buffer_t();
+    
+    auto data = read_sectors(sector, 1);
+    if (unlikely(!data)) return data;
+    
+    std::lock_guard<std::mutex> lock(fat_cache_mtx);
+    slot.sector = sector;
+    slot.data   = data;
+    return data;
+  }
+  
+  uint32_t FAT::cl_next(uint32_t cl, bool read)
+  {
+    uint32_t sector = cl_to_entry_sector(cl);
+    uint32_t offset = cl_to_entry_offset(cl);
+    
+    auto buffer = fat_sector(sector, read);
+    if (unlikely(!buffer)) return read ? CL_BAD : CL_FREE;
+    const uint8_t* data = buffer.get();
+    
+    uint32_t value;
+    switch (this->fat_type)
+    {
+    case T_FAT12:
+      {
+        // 12-bit entries can straddle two FAT sectors
+        value = data[offset];
+        if (unlikely(offset + 1u == sector_size))
+        {
+          buffer = fat_sector(sector + 1, read);
+          if (unlikely(!buffer)) return read ? CL_BAD : CL_FREE;
+          value |= buffer.get()[0] << 8;
+        }
+        else
+        {
+          value |= data[offset + 1] << 8;
+        }
+        value = (cl & 1) ? (value >> 4) : (value & 0xFFF);
+        
+        if (value >= 0xFF8) return CL_EOC;
+        break;
+      }
+    case T_FAT16:
+      {
+        uint16_t value16;
+        memcpy(&value16, data + offset, sizeof(value16));
+        value = value16;
+        
+        if (value >= 0xFFF8) return CL_EOC;
+        break;
+      }
+    default: // T_FAT32
+      {
+        memcpy(&value, data + offset, sizeof(value));
+        // the top 4 bits are reserved
+        value &= 0x0FFFFFFF;
+        
+        if (value >= CL_EOC) return CL_EOC;
+        break;
+      }
+    }
+    // free, reserved or out of range entries can't be in a chain
+    if (unlikely(value < 2 || value >= this->clusters + 2))
+        return CL_BAD;
+    return value;
+  }
+  
+  bool FAT::next_chunk(uint32_t& cl, uint32_t& index, uint32_t count, uint32_t& visited)
+  {
+    index += count;
+    if (index < cl_sectors(cl))
+        return true;
+    
+    // the FAT12/16 root region has no chain
+    if (cl == 0) return false;
+    
+    cl = cl_next(cl);
+    index = 0;
+    // a chain longer than the volume must be a loop
+    if (unlikely(++visited > this->clusters))
+        cl = CL_BAD;
+    return !cl_is_end(cl);
+  }
+  
+  FAT::extents_t FAT::extents(uint32_t cl)
+  {
+    {
+      std::lock_guard<std::mutex> lock(extent_cache_mtx);
+      auto it = extent_cache.find(cl);
+      if (it != extent_cache.end())
+          return it->second;
+    }
+    
+    auto map = std::make_shared<extent_map> ();
+    uint32_t first  = cl;
+    uint32_t offset = 0;
+    
+    while (!cl_is_end(cl))
+    {
+      auto* last = map->empty() ? nullptr : &map->back();
+      // extend the current run, or start a new one
+      if (last && last->cluster + last->count == cl)
+          last->count++;
+      else
+          map->push_back({offset, cl, 1});
+      
+      // a chain longer than the volume must be a loop
+      if (unlikely(++offset > this->clusters))
+          return nullptr;
+      cl = cl_next(cl);
+    }
+    // bad clusters or I/O errors end chains early
+    if (unlikely(cl == CL_BAD))
+        return nullptr;
+    
+    std::lock_guard<std::mutex> lock(extent_cache_mtx);
+    if (extent_cache.size() >= EXTENT_CACHE_MAX)
+        extent_cache.clear();
+    extent_cache.emplace(first, map);
+    return map;
+  }
+  
+  FAT::extent_map::const_iterator
+  FAT::extent_find(const extent_map& map, uint32_t offset)
+  {
+    // the last extent starting at or before @offset
+    auto it = std::upper_bound(map.begin(), map.end(), offset,
+    [] (uint32_t ofs, const extent_t& ext)
+    {
+      return ofs < ext.offset;
+    });
+    if (it == map.begin())
+        return map.end();
+    --it;
+    // make sure @offset is inside the run
+    if (offset - it->offset >= it->count)
+        return map.end();
+    return it;
+  }
+}
@@ -1,7 +1,72 @@
 #include <fs/filesystem.hpp>
 
+#include <cstring>
+
 namespace fs
 {
   error_t no_error = false;
   
+  error_t FileSystem::statfs(Statfs&)
+  {
+    return true;
+  }
+  
+  error_t FileSystem::ls(const std::string& path, dirvec_t ents)
+  {
+    auto cursor = begin(path);
+    if (!cursor) return true;
+    
+    DirentView ent;
+    while (cursor->next(ent))
+      ents->push_back(ent.to_dirent());
+    
+    return cursor->error();
+  }
+  
+  void FileSystem::readFile(const Dirent& ent, buffer_t dest, on_read_func callback)
+  {
+    readFile(ent,
+    [dest, callback] (error_t err, buffer_t buf, uint64_t len)
+    {
+      if (err || len > dest.size())
+      {
+        callback(true, buffer_t(), 0);
+        return;
+      }
+      memcpy(dest.get(), buf.get(), len);
+      callback(no_error, dest.slice(0, len), len);
+    });
+  }
+  
+  FileSystem::Buffer FileSystem::read(const Dirent& ent, uint64_t pos, buffer_t dest)
+  {
+    auto buf = read(ent, pos, dest.size());
+    if (buf.err) return buf;
+    
+    memcpy(dest.get(), buf.buffer.get(), buf.len);
+    return Buffer(no_error, dest.slice(0, buf.len), buf.len);
+  }
+  
+  error_t FileSystem::readv(const Dirent& ent, uint64_t pos, uint64_t n, slices_t& out)
+  {
+    auto buf = read(ent, pos, n);
+    if (buf.err) return true;
+    
+    if (buf.len) out.push_back(buf.buffer.slice(0, buf.len));
+    return no_error;
+  }
+  
+  error_t FileSystem::list(const std::string& path, DirList& list)
+  {
+    list.clear();
+    auto cursor = begin(path);
+    if (!cursor) return true;
+    
+    DirentView ent;
+    while (cursor->next(ent))
+      list.push_back(ent);
+    
+    return cursor->error();
+  }
+  
 }
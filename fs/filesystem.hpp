@@ -23,6 +23,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 #include <functional>
 
@@ -34,13 +35,23 @@ public:
   
   using dirvector = std::vector<Dirent>;
   using dirvec_t  = std::shared_ptr<dirvector>;
-  using buffer_t  = std::shared_ptr<uint8_t>;
+  using buffer_t  = fs::buffer_t;
+  using slices_t  = std::vector<buffer_t>;
   
   using on_mount_func = std::function<void(error_t)>;
   using on_ls_func    = std::function<void(error_t, dirvec_t)>;
   using on_read_func  = std::function<void(error_t, buffer_t, uint64_t)>;
   using on_stat_func  = std::function<void(error_t, const Dirent&)>;
   
+  /** Capacity of a mounted filesystem, in allocation units */
+  struct Statfs
+  {
+    uint64_t block_size;  //< bytes in an allocation unit
+    uint64_t blocks;      //< allocation units for data
+    uint64_t blocks_free; //< free units, FREE_UNKNOWN if not recorded
+  };
+  static constexpr uint64_t FREE_UNKNOWN = UINT64_MAX;
+  
   struct Buffer
   {
     error_t  err;
@@ -120,25 +131,142 @@ public:
     }
   }; //< struct Dirent
   
+  /** Directory entry read through a cursor, the name is not
+      null-terminated and only valid until the cursor moves on */
+  struct DirentView {
+    Enttype     ftype;
+    const char* fname;
+    size_t      fname_len;
+    uint64_t    block;
+    uint64_t    parent; //< Parent's block#
+    uint64_t    size;
+    uint32_t    attrib;
+    
+    // make an owning copy of this entry
+    Dirent to_dirent() const
+    {
+      return Dirent(ftype, std::string(fname, fname_len),
+                    block, parent, size, attrib);
+    }
+  }; //< struct DirentView
+  
+  /** Streams the entries of a directory, one at a time */
+  class DirCursor {
+  public:
+    /** Read the next entry into @ent, returns false at the end or on error */
+    virtual bool next(DirentView& ent) = 0;
+    /** True if the cursor stopped because of an error */
+    virtual error_t error() const = 0;
+    
+    virtual ~DirCursor() = default;
+  }; //< class DirCursor
+  
+  using cursor_t = std::unique_ptr<DirCursor>;
+  
+  /** Packed directory listing: fixed-size records, with all
+      the names stored back to back in one shared blob */
+  class DirList {
+  public:
+    struct Entry {
+      uint64_t block;
+      uint64_t parent;    //< Parent's block#
+      uint64_t size;
+      uint32_t name_ofs;  //< Offset of the name in the blob
+      uint16_t name_len;
+      uint8_t  ftype;
+      uint8_t  attrib;    //< FAT attributes fit in a byte
+    };
+    
+    size_t size() const noexcept
+    { return ents.size(); }
+    bool empty() const noexcept
+    { return ents.empty(); }
+    
+    const Entry& operator[] (size_t i) const
+    { return ents[i]; }
+    Enttype type(size_t i) const
+    { return (Enttype) ents[i].ftype; }
+    
+    // the name of entry @i, not null-terminated
+    const char* name(size_t i) const
+    { return names.data() + ents[i].name_ofs; }
+    size_t name_len(size_t i) const
+    { return ents[i].name_len; }
+    
+    // make an owning copy of entry @i
+    Dirent dirent(size_t i) const
+    {
+      const auto& E = ents[i];
+      return Dirent(type(i), std::string(name(i), E.name_len),
+                    E.block, E.parent, E.size, E.attrib);
+    }
+    
+    void push_back(const DirentView& ent)
+    {
+      ents.push_back({ent.block, ent.parent, ent.size,
+                      (uint32_t) names.size(), (uint16_t) ent.fname_len,
+                      (uint8_t) ent.ftype, (uint8_t) ent.attrib});
+      names.insert(names.end(), ent.fname, ent.fname + ent.fname_len);
+    }
+    void reserve(size_t entries, size_t name_bytes)
+    {
+      ents.reserve(entries);
+      names.reserve(name_bytes);
+    }
+    void clear() noexcept
+    {
+      ents.clear();
+      names.clear();
+    }
+    
+    // bytes held by the listing
+    size_t memory() const noexcept
+    { return ents.capacity() * sizeof(Entry) + names.capacity(); }
+    
+  private:
+    std::vector<Entry> ents;
+    std::vector<char>  names;
+  }; //< class DirList
+  
    /** Mount this filesystem with LBA at @base_sector */
     virtual void mount(uint64_t lba, uint64_t size, on_mount_func on_mount) = 0;
     
     /** @param path: Path in the mounted filesystem */
     virtual void    ls(const std::string& path, on_ls_func) = 0;
-    virtual error_t ls(const std::string& path, dirvec_t e) = 0;
+    /** Sync listing, by default collected from a cursor */
+    virtual error_t ls(const std::string& path, dirvec_t e);
+    
+    /** Sync listing into the packed @list, which is cleared first */
+    virtual error_t list(const std::string& path, DirList& list);
+    
+    /** Open a cursor over the directory at @path, nullptr if there is none */
+    virtual cursor_t begin(const std::string& path) = 0;
     
     /** Read an entire file into a buffer, then call on_read */
     virtual void readFile(const std::string&, on_read_func) = 0;
     virtual void readFile(const Dirent& ent,  on_read_func) = 0;
+    /** Read an entire file into @dest, which must be large enough */
+    virtual void readFile(const Dirent& ent, buffer_t dest, on_read_func);
     
-    /** Read @n bytes from direntry from position @pos */
+    /** Read @n bytes from direntry from position @pos
+        The buffer can be a view of cached sectors, so it must not be written to */
     virtual void   read(const Dirent&, uint64_t pos, uint64_t n, on_read_func) = 0;
     virtual Buffer read(const Dirent&, uint64_t pos, uint64_t n) = 0;
+    /** Read from position @pos into @dest, until it is full or the file ends */
+    virtual Buffer read(const Dirent&, uint64_t pos, buffer_t dest);
+    
+    /** Append @n bytes from position @pos to @out as a list of buffers,
+        pointing into device buffers where possible instead of copying */
+    virtual error_t readv(const Dirent&, uint64_t pos, uint64_t n, slices_t& out);
     
     /** Return information about a file or directory */
     virtual void   stat(const std::string& ent, on_stat_func) = 0;
     virtual Dirent stat(const std::string& ent) = 0;
     
+    /** Capacity and free space from what the filesystem keeps track of,
+        without scanning it. The default has nothing to report */
+    virtual error_t statfs(Statfs&);
+    
     /** Returns the name of this filesystem */
     virtual std::string name() const = 0;
 
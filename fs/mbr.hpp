@@ -20,6 +20,7 @@
 #define FS_MBR_HPP
 
 #include <string>
+#include <cstddef>
 #include <cstdint>
 
 namespace fs {
@@ -58,6 +59,23 @@ struct MBR {
     char     system_id[8];     // FAT12 or FAT16
   } __attribute__((packed));
   
+  /** FAT32 extended BPB, following large_sectors in place of the legacy fields */
+  struct BPB32 {
+    uint32_t sectors_per_fat;
+    uint16_t ext_flags;
+    uint16_t version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;    // 0 or 0xFFFF if there is none
+    uint16_t backup_boot;
+    uint8_t  reserved[12];
+    uint8_t  disk_number;
+    uint8_t  current_head;
+    uint8_t  signature;        // Must be 0x28 or 0x29
+    uint32_t serial_number;
+    char     volume_label[11];
+    char     system_id[8];     // FAT32
+  } __attribute__((packed));
+  
   struct mbr {
     uint8_t   jump[3];
     char      oem_name[8];
@@ -67,6 +85,8 @@ struct MBR {
 
     inline BPB* bpb() noexcept
     { return reinterpret_cast<BPB*>(boot); }
+    inline BPB32* bpb32() noexcept
+    { return reinterpret_cast<BPB32*>(boot + offsetof(BPB, disk_number)); }
   } __attribute__((packed));
 
   static std::string id_to_name(uint8_t);
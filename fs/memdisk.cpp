@@ -32,54 +32,43 @@ extern "C" {
 namespace fs {
 
 MemDisk::MemDisk() noexcept
-  : image_start { &_DISK_START_ },
-    image_end   { &_DISK_END_ }
+  : MemDisk(&_DISK_START_, &_DISK_END_)
+{}
+
+MemDisk::MemDisk(void* start, void* end, block_t block_size) noexcept
+  : image_start { start },
+    image_end   { end },
+    block_bytes { block_size },
+    image_owner { (uint8_t*) start, [] (uint8_t*) {} }
 {}
 
 void MemDisk::read(block_t blk, on_read_func callback) {
-  auto* sector_loc = ((char*) image_start) + blk * block_size();
-  // Disallow reading memory past disk image
-  if (unlikely(sector_loc >= image_end))
-  {
-    callback(buffer_t()); return;
-  }
-  
-  auto* buffer = new uint8_t[block_size()];
-  assert( memcpy(buffer, sector_loc, block_size()) == buffer );
-  
-  callback( buffer_t(buffer, std::default_delete<uint8_t[]>()) );
+  callback( read_sync(blk) );
 }
 
 void MemDisk::read(block_t start, block_t count, on_read_func callback) {
-  auto* start_loc = ((char*) image_start) + start * block_size();
-  auto* end_loc   = start_loc + count * block_size();
-  // Disallow reading memory past disk image
-  if (unlikely(end_loc >= image_end))
-  {
-    callback(buffer_t()); return;
-  }
-  
-  auto* buffer = new uint8_t[count * block_size()];
-  assert( memcpy(buffer, start_loc, count * block_size()) == buffer );
-  
-  callback( buffer_t(buffer, std::default_delete<uint8_t[]>()) );
+  callback( read_sync(start, count) );
 }
 
 MemDisk::buffer_t MemDisk::read_sync(block_t blk)
 {
-  auto* loc = ((char*) image_start) + blk * block_size();
+  return read_sync(blk, 1);
+}
+
+MemDisk::buffer_t MemDisk::read_sync(block_t start, block_t count)
+{
+  auto* start_loc = ((char*) image_start) + start * block_size();
+  auto* end_loc   = start_loc + count * block_size();
   // Disallow reading memory past disk image
-  if (unlikely(loc >= image_end))
+  if (unlikely(end_loc > image_end))
     return buffer_t();
   
-  auto* buffer = new uint8_t[block_size()];
-  assert( memcpy(buffer, loc, block_size()) == buffer );
-  
-  return buffer_t(buffer, std::default_delete<uint8_t[]>());
+  // the image is never written to, so hand out views into it
+  return view(start_loc, count * block_size());
 }
 
 MemDisk::block_t MemDisk::size() const noexcept {
-  return ((char*) image_end - (char*) image_start) / SECTOR_SIZE;
+  return ((char*) image_end - (char*) image_start) / block_size();
 }
   
 } //< namespace fs
@@ -20,6 +20,7 @@
 #define FS_MEMDISK_HPP
 
 #include <cstdint>
+#include <memory>
 
 #include <hw/disk_device.hpp>
 
@@ -29,11 +30,15 @@ class MemDisk : public hw::IDiskDevice {
 public:
   static constexpr size_t SECTOR_SIZE = 512;
   
+  /** Disk image linked into the binary */
   MemDisk() noexcept;
+  /** Disk image located in memory from @start to @end,
+      made of sectors of @block_size bytes */
+  MemDisk(void* start, void* end, block_t block_size = SECTOR_SIZE) noexcept;
   
   /** Returns the optimal block size for this device.  */
   virtual block_t block_size() const noexcept override
-  { return SECTOR_SIZE; }
+  { return block_bytes; }
   
   virtual const char* name() const noexcept override
   {
@@ -47,12 +52,20 @@ public:
   read(block_t start, block_t cnt, on_read_func reader) override;
   
   virtual buffer_t read_sync(block_t blk) override;
+  virtual buffer_t read_sync(block_t start, block_t cnt) override;
   
   virtual block_t size() const noexcept override;
   
 private:
-  void*  image_start;
-  void*  image_end;
+  // returns a buffer of @len bytes pointing into the image at @loc
+  buffer_t view(void* loc, size_t len) const
+  { return buffer_t(image_owner, (uint8_t*) loc, len); }
+  
+  void*   image_start;
+  void*   image_end;
+  block_t block_bytes;
+  // every buffer handed out shares ownership with this
+  std::shared_ptr<uint8_t> image_owner;
 }; //< class MemDisk
   
 } //< namespace fs
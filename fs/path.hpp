@@ -72,10 +72,10 @@ public:
   bool empty() const noexcept
   { return stk.empty(); }
   
-  std::string front() const 
+  const std::string& front() const 
   { return stk.front(); }
 
-  std::string back() const
+  const std::string& back() const
   { return stk.back(); }
 
   Path& pop_front() noexcept
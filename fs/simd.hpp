@@ -0,0 +1,80 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef FS_SIMD_HPP
+#define FS_SIMD_HPP
+
+/**
+ *  Vector kernels are compiled with __attribute__((target(...)))
+ *  under FS_SIMD_X86, next to a scalar version, and FS_SIMD_SELECT
+ *  picks the widest one this CPU can run
+**/
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FS_SIMD_X86
+#endif
+
+#ifndef likely
+#define likely(x)       __builtin_expect(!!(x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+#endif
+
+namespace fs {
+namespace simd {
+
+enum level_t { SCALAR, SSE2, AVX2 };
+
+/** The widest vector extension the CPU supports, checked once */
+inline level_t level() noexcept
+{
+  static const level_t detected = [] {
+#ifdef FS_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return AVX2;
+    if (__builtin_cpu_supports("sse2")) return SSE2;
+#endif
+    return SCALAR;
+  }();
+  return detected;
+}
+
+/** The version of a kernel for this CPU */
+template <typename Func>
+inline Func select(Func scalar, Func sse2, Func avx2) noexcept
+{
+  switch (level())
+  {
+  case AVX2: return avx2;
+  case SSE2: return sse2;
+  default:   return scalar;
+  }
+}
+
+} //< namespace simd
+} //< namespace fs
+
+// the vector versions only exist on x86
+#ifdef FS_SIMD_X86
+#define FS_SIMD_SELECT(scalar, sse2, avx2) ::fs::simd::select(scalar, sse2, avx2)
+#else
+#define FS_SIMD_SELECT(scalar, sse2, avx2) (scalar)
+#endif
+
+#endif //< FS_SIMD_HPP
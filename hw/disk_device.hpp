@@ -23,13 +23,15 @@
 #include <cstdint>
 #include <functional>
 
+#include "slice.hpp"
+
 namespace hw
 {
 
 class IDiskDevice {
 public:
   using block_t = uint64_t; //< Disk device block size
-  using buffer_t = std::shared_ptr<uint8_t>;
+  using buffer_t = Slice; //< Shared range of bytes
   
   // Delegate for result of reading a disk sector
   using on_read_func = std::function<void(buffer_t)>;
@@ -44,7 +46,8 @@ public:
   virtual block_t block_size() const noexcept = 0;
   
   /**
-   *  Read block(s) from blk and call func with result
+   *  Read block(s) from blk and call func with result, a buffer
+   *  of count * block_size() bytes
    *  A null-pointer is passed to result if something bad happened
    *  Validate using !buffer_t:
    *  if (!buffer)
@@ -53,8 +56,18 @@ public:
   virtual void read(block_t blk, on_read_func func) = 0;
   virtual void read(block_t blk, block_t count, on_read_func) = 0;
   
+  /**
+   *  Hint that @count blocks from @blk will be read soon, so that the
+   *  device, or a cache in front of it, can start fetching them
+   *  The default ignores the hint
+  **/
+  virtual void prefetch(block_t blk, block_t count)
+  { (void) blk; (void) count; }
+  
   /** read synchronously the block @blk  */
   virtual buffer_t read_sync(block_t blk) = 0;
+  /** read synchronously @count blocks starting at @blk, as one buffer */
+  virtual buffer_t read_sync(block_t blk, block_t count) = 0;
   
   /** Default destructor */
   virtual ~IDiskDevice() noexcept = default;
@@ -0,0 +1,98 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef HW_SLICE_HPP
+#define HW_SLICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hw
+{
+
+/**
+ *  A range of bytes in a shared buffer
+ *  
+ *  The slice keeps whatever owns the memory alive (a heap buffer,
+ *  a pooled chunk, a memory mapping), so sub-ranges of a buffer
+ *  can be handed out without copying. It reads like a shared_ptr:
+ *  get() is the first byte, and an empty slice tests false.
+**/
+class Slice {
+public:
+  Slice() noexcept = default;
+  Slice(std::nullptr_t) noexcept {}
+  
+  /** Borrow @len bytes at @data, which the caller keeps alive */
+  Slice(uint8_t* data, size_t len) noexcept
+    : ptr(data), len(len) {}
+  
+  /** Take ownership of @len bytes at @data, freed with @deleter */
+  template <typename Deleter>
+  Slice(uint8_t* data, Deleter deleter, size_t len)
+    : owner(data, deleter), ptr(data), len(len) {}
+  
+  /** View @len bytes at @data, kept alive by @owner */
+  template <typename T>
+  Slice(std::shared_ptr<T> owner, uint8_t* data, size_t len) noexcept
+    : owner(std::move(owner)), ptr(data), len(len) {}
+  
+  uint8_t* get() const noexcept
+  { return ptr; }
+  uint8_t* data() const noexcept
+  { return ptr; }
+  size_t size() const noexcept
+  { return len; }
+  bool empty() const noexcept
+  { return len == 0; }
+  
+  uint8_t& operator[] (size_t i) const noexcept
+  { return ptr[i]; }
+  
+  explicit operator bool() const noexcept
+  { return ptr != nullptr; }
+  
+  /** @len bytes starting at @offset, sharing ownership with this */
+  Slice slice(size_t offset, size_t len) const noexcept
+  { return Slice(owner, ptr + offset, len); }
+  /** Everything from @offset to the end */
+  Slice slice(size_t offset) const noexcept
+  { return slice(offset, len - offset); }
+  
+  /** The number of slices sharing this memory */
+  long use_count() const noexcept
+  { return owner.use_count(); }
+  
+  void reset() noexcept
+  { *this = Slice(); }
+  
+private:
+  std::shared_ptr<void> owner;
+  uint8_t* ptr = nullptr;
+  size_t   len = 0;
+}; //< class Slice
+
+inline bool operator== (const Slice& s, std::nullptr_t) noexcept
+{ return !s; }
+inline bool operator!= (const Slice& s, std::nullptr_t) noexcept
+{ return (bool) s; }
+
+} //< namespace hw
+
+#endif //< HW_SLICE_HPP
@@ -5,12 +5,15 @@
 #include <cerrno>
 #include <cstring>
 
+#include <fs/block_cache.hpp>
 #include <fs/disk.hpp>
 #include <fs/fat.hpp>
 #include <memdisk.hpp>
 
 using namespace fs;
-MemDisk device;
+MemDisk image;
+// keep up to 1 MB of hot blocks in memory
+BlockCache device {image, 1024 * 1024};
 
 off64_t check_image(const char* path)
 {
@@ -55,7 +58,10 @@ int main(int argc, const char** argv)
   printf("Image %s is %lu bytes\n", argv[1], size);
   printf("--------------------------------------\n");
   
-  device.set_image(argv[1]);
+  // the logical sector size of the image, when it isn't 512 bytes
+  const long block_size = (argc > 2) ? atol(argv[2]) : 512;
+  if (!image.set_image(argv[1], block_size))
+    return EXIT_FAILURE;
   
   using MountedDisk = Disk<FAT>;
   auto disk = std::make_shared<MountedDisk> (device);
@@ -2,56 +2,107 @@
 
 #include <cstring>
 #include <cassert>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs
 {
+  MemDisk::~MemDisk()
+  {
+    if (image_fd >= 0) close(image_fd);
+  }
+  
+  bool MemDisk::set_image(const std::string& disk_image, block_t block_size)
+  {
+    if (block_size < 512 || (block_size & (block_size - 1)))
+    {
+      printf("set_image (%s) invalid block size: %lu\n", disk_image.c_str(), block_size);
+      return false;
+    }
+    if (image_fd >= 0) close(image_fd);
+    
+    block_bytes = block_size;
+    image = disk_image;
+    image_size = 0;
+    image_fd = open(image.c_str(), O_RDONLY);
+    if (image_fd < 0)
+    {
+      printf("set_image (%s) open failed: %s\n", image.c_str(), strerror(errno));
+      return false;
+    }
+    
+    struct stat st;
+    if (fstat(image_fd, &st) < 0)
+    {
+      printf("set_image (%s) fstat failed: %s\n", image.c_str(), strerror(errno));
+      close(image_fd);
+      image_fd = -1;
+      return false;
+    }
+    image_size = st.st_size;
+    return true;
+  }
+  
   void MemDisk::read(block_t blk, on_read_func callback)
   {
     auto buf = read_sync(blk);
     callback(buf);
   }
+  void MemDisk::read(block_t blk, block_t count, on_read_func callback)
+  {
+    auto buf = read_sync(blk, count);
+    callback(buf);
+  }
+  void MemDisk::prefetch(block_t blk, block_t count)
+  {
+    if (image_fd < 0) return;
+    posix_fadvise(image_fd, blk * block_size(), count * block_size(), POSIX_FADV_WILLNEED);
+  }
+  
   MemDisk::buffer_t MemDisk::read_sync(block_t blk)
   {
-    // check for existing entry in cache
-    for (auto& entry : cache)
-    if (entry.block == blk)
-    {
-      return entry.data;
-    }
-    // make room if needed
-    while (cache.size() >= CACHE_SIZE)
-        free_entry();
-    // retrieve block from disk
-    auto data = read_block(blk);
+    return read_sync(blk, 1);
+  }
+  
+  MemDisk::buffer_t MemDisk::read_sync(block_t blk, block_t count)
+  {
+    auto data = read_block(blk, count);
     if (!data)
     {
-      printf("Failed to read block %lu\n", blk);
-      return buffer_t();
+      printf("Failed to read blocks %lu to %lu\n", blk, blk + count);
     }
-    // save for later
-    cache.emplace_back(blk, data);
     return data;
   }
   
-  MemDisk::buffer_t MemDisk::read_block(block_t blk)
+  MemDisk::buffer_t MemDisk::read_block(block_t blk, block_t count)
   {
-    FILE* f = fopen(image.c_str(), "r");
-    if (!f)
+    if (image_fd < 0)
     {
       return buffer_t();
     }
     
-    fseek(f, blk * block_size(), SEEK_SET);
+    const size_t len = count * block_size();
+    off_t offset = blk * block_size();
     
-    auto* buffer = new uint8_t[block_size()];
-    int res = fread(buffer, block_size(), 1, f);
-    // fail when not reading block size
-    if (res < 0)
+    auto data = pool.get(len);
+    auto* buffer = data.get();
+    size_t total = 0;
+    while (total < len)
     {
-      printf("read_block (blk=%lu) fread failed: %s\n", blk, strerror(errno));
-      return buffer_t();
+      ssize_t res = pread(image_fd, buffer + total, len - total, offset + total);
+      if (res < 0 && errno == EINTR) continue;
+      // fail when not reading the whole range
+      if (res <= 0)
+      {
+        if (res < 0)
+          printf("read_block (blk=%lu) pread failed: %s\n", blk, strerror(errno));
+        return buffer_t();
+      }
+      total += res;
     }
-    // call event handler for successful block read
-    return buffer_t(buffer, std::default_delete<uint8_t[]>());
+    return data;
   }
 }
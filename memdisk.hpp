@@ -21,31 +21,26 @@
 
 #include <cstdint>
 #include <cstdio>
-#include <deque>
 #include <functional>
+#include <string>
 #include "hw/disk_device.hpp"
+#include "fs/buffer_pool.hpp"
 
 namespace fs
 {
   class MemDisk : public hw::IDiskDevice
   {
   public:
-    struct Entry
-    {
-      Entry(uint32_t blk, buffer_t dat)
-        : block(blk), data(dat) {}
-      
-      uint32_t block;
-      buffer_t data;
-    };
+    MemDisk() = default;
+    ~MemDisk();
     
-    MemDisk(size_t cache_size = 16)
-      : CACHE_SIZE(cache_size) {}
+    MemDisk(const MemDisk&) = delete;
+    MemDisk& operator= (const MemDisk&) = delete;
     
-    void set_image(std::string disk_image)
-    {
-      image = disk_image;
-    }
+    // open @disk_image for reading, the image stays open
+    // until another image is set or the disk is destroyed
+    // @block_size is the logical sector size of the image
+    bool set_image(const std::string& disk_image, block_t block_size = 512);
     
     virtual const char* name() const noexcept override
     {
@@ -53,36 +48,28 @@ namespace fs
     }
     virtual block_t size() const noexcept override
     {
-      FILE* f = fopen(image.c_str(), "r");
-      if (!f) return 0;
-      
-      fseek(f, 0L, SEEK_END);
-      off64_t sz = ftell(f);
-      fclose(f);
-      
-      return sz;
+      return image_size / block_size();
     }
     virtual block_t block_size() const noexcept override
     {
-      return 512;
+      return block_bytes;
     }
     
     virtual void read(block_t blk, on_read_func func) override;
+    virtual void read(block_t blk, block_t count, on_read_func func) override;
     virtual buffer_t read_sync(block_t) override;
-    // not implemented here:
-    virtual void read(block_t, block_t, on_read_func) override {}
+    virtual buffer_t read_sync(block_t blk, block_t count) override;
+    // ask the kernel to read the blocks into the page cache
+    virtual void prefetch(block_t blk, block_t count) override;
     
   private:
-    void free_entry()
-    {
-      cache.pop_front();
-    }
-    
-    buffer_t read_block(block_t blk);
+    buffer_t read_block(block_t blk, block_t count);
     
     std::string  image;
-    const size_t CACHE_SIZE;
-    std::deque<Entry> cache;
+    int          image_fd = -1;
+    uint64_t     image_size = 0;
+    block_t      block_bytes = 512;
+    BufferPool   pool;
   };
   
 }
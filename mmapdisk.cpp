@@ -0,0 +1,99 @@
+#include "mmapdisk.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs
+{
+  bool MmapDisk::set_image(const std::string& disk_image, block_t block_size)
+  {
+    if (block_size < 512 || (block_size & (block_size - 1)))
+    {
+      printf("set_image (%s) invalid block size: %lu\n", disk_image.c_str(), block_size);
+      return false;
+    }
+    image_owner = nullptr;
+    image_start = image_end = nullptr;
+    block_bytes = block_size;
+    
+    int fd = open(disk_image.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      printf("set_image (%s) open failed: %s\n", disk_image.c_str(), strerror(errno));
+      return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+      printf("set_image (%s) invalid image\n", disk_image.c_str());
+      close(fd);
+      return false;
+    }
+    const size_t len = st.st_size;
+    
+    void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+      printf("set_image (%s) mmap failed: %s\n", disk_image.c_str(), strerror(errno));
+      return false;
+    }
+    
+    image_start = map;
+    image_end   = (char*) map + len;
+    image_owner = std::shared_ptr<uint8_t>((uint8_t*) map,
+    [len] (uint8_t* ptr)
+    {
+      munmap(ptr, len);
+    });
+    return true;
+  }
+  
+  void MmapDisk::read(block_t blk, on_read_func callback)
+  {
+    callback(read_sync(blk, 1));
+  }
+  void MmapDisk::read(block_t blk, block_t count, on_read_func callback)
+  {
+    callback(read_sync(blk, count));
+  }
+  
+  void MmapDisk::prefetch(block_t blk, block_t count)
+  {
+    if (image_start == nullptr || blk >= size()) return;
+    count = std::min(count, size() - blk);
+    
+    // madvise wants page aligned addresses
+    const uintptr_t page  = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) image_start + blk * block_size();
+    uintptr_t end   = start + count * block_size();
+    start &= ~(page - 1);
+    madvise((void*) start, end - start, MADV_WILLNEED);
+  }
+  
+  MmapDisk::buffer_t MmapDisk::read_sync(block_t blk)
+  {
+    return read_sync(blk, 1);
+  }
+  
+  MmapDisk::buffer_t MmapDisk::read_sync(block_t blk, block_t count)
+  {
+    auto* start_loc = (char*) image_start + blk * block_size();
+    // disallow reading past the end of the image
+    if (blk + count > size())
+    {
+      return buffer_t();
+    }
+    // aliases the mapping: no copy, and no allocation
+    return buffer_t(image_owner, (uint8_t*) start_loc, count * block_size());
+  }
+}
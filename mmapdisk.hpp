@@ -0,0 +1,77 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef MMAPDISK_HPP
+#define MMAPDISK_HPP
+
+#include <cstdint>
+#include <string>
+#include "hw/disk_device.hpp"
+
+namespace fs
+{
+  /**
+   *  Disk image mapped into memory
+   *  
+   *  Reads return buffers pointing straight into the mapping,
+   *  so nothing is copied or allocated per block. The mapping
+   *  stays alive until the last buffer referring to it is gone.
+  **/
+  class MmapDisk : public hw::IDiskDevice
+  {
+  public:
+    MmapDisk() = default;
+    
+    MmapDisk(const MmapDisk&) = delete;
+    MmapDisk& operator= (const MmapDisk&) = delete;
+    
+    // map @disk_image read-only, replacing any previous image
+    // @block_size is the logical sector size of the image
+    bool set_image(const std::string& disk_image, block_t block_size = 512);
+    
+    virtual const char* name() const noexcept override
+    {
+      return "MmapDisk";
+    }
+    virtual block_t size() const noexcept override
+    {
+      return ((char*) image_end - (char*) image_start) / block_size();
+    }
+    virtual block_t block_size() const noexcept override
+    {
+      return block_bytes;
+    }
+    
+    virtual void read(block_t blk, on_read_func func) override;
+    virtual void read(block_t blk, block_t count, on_read_func func) override;
+    virtual buffer_t read_sync(block_t blk) override;
+    virtual buffer_t read_sync(block_t blk, block_t count) override;
+    // ask the kernel to page in the blocks
+    virtual void prefetch(block_t blk, block_t count) override;
+    
+  private:
+    void* image_start = nullptr;
+    void* image_end   = nullptr;
+    block_t block_bytes = 512;
+    // owns the mapping, shared with every buffer handed out
+    std::shared_ptr<uint8_t> image_owner;
+  };
+  
+}
+
+#endif
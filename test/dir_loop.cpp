@@ -0,0 +1,76 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A directory whose cluster chain loops back on itself must fail
+// to list or search, instead of being read forever
+
+#include <cstdlib>
+
+#include <fs/disk.hpp>
+#include <fs/fat.hpp>
+
+#include "fat_image.hpp"
+
+using namespace fs;
+using test::FatImage;
+
+int main()
+{
+  int failures = 0;
+  
+  // DIR is full, with no end marker, and its last cluster
+  // points back at the second one
+  FatImage image(8, 8 * 16 - 2);
+  image.link(FatImage::DIR_CLUSTER + 7, FatImage::DIR_CLUSTER + 1);
+  test::ImageDisk device(image);
+  
+  auto disk = std::make_shared<Disk<FAT>> (device);
+  bool mounted = false;
+  disk->mount(Disk<FAT>::MBR,
+  [&mounted] (fs::error_t err) { mounted = !err; });
+  CHECK(mounted, "mount");
+  if (!mounted) return EXIT_FAILURE;
+  auto& fs = disk->fs();
+  
+  auto ents = new_shared_vector();
+  CHECK(fs.ls("/DIR", ents), "sync ls of a looping directory succeeded");
+  
+  int result = -1;
+  fs.ls("/DIR",
+  [&result] (fs::error_t err, FileSystem::dirvec_t) { result = err; });
+  CHECK(result == 1, "async ls of a looping directory gave %d", result);
+  
+  auto cursor = fs.begin("/DIR");
+  CHECK(cursor != nullptr, "cursor over DIR");
+  if (cursor)
+  {
+    FileSystem::DirentView ent;
+    while (cursor->next(ent)) {}
+    CHECK(cursor->error(), "cursor over a looping directory succeeded");
+  }
+  
+  // a name that isn't there is searched for through the whole chain
+  CHECK(!fs.stat("/DIR/MISSING").is_valid(), "sync stat found a missing entry");
+  
+  result = -1;
+  fs.stat("/DIR/MISSING2",
+  [&result] (fs::error_t err, const FileSystem::Dirent&) { result = err; });
+  CHECK(result == 1, "async stat in a looping directory gave %d", result);
+  
+  printf("dir_loop: %d failures\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Directory prefetching must only hint the device: a lookup that
+// stops early reads the clusters it scanned and nothing more
+
+#include <cstdlib>
+
+#include <fs/block_cache.hpp>
+#include <fs/disk.hpp>
+#include <fs/fat.hpp>
+
+#include "fat_image.hpp"
+
+using namespace fs;
+using test::FatImage;
+
+int main()
+{
+  int failures = 0;
+  
+  FatImage image(64, 900);
+  test::ImageDisk device(image);
+  BlockCache cache(device, 4 << 20);
+  
+  auto disk = std::make_shared<Disk<FAT>> (cache);
+  bool mounted = false;
+  disk->mount(Disk<FAT>::MBR,
+  [&mounted] (fs::error_t err) { mounted = !err; });
+  CHECK(mounted, "mount");
+  if (!mounted) return EXIT_FAILURE;
+  auto& fs = disk->fs();
+  
+  // a miss scans all of DIR, which leaves its chain in the FAT cache
+  CHECK(!fs.stat("/DIR/MISSING").is_valid(), "stat of a missing file");
+  
+  // both entries are in the second cluster of DIR
+  const uint32_t sync_file  = 20;
+  const uint32_t async_file = 21;
+  CHECK(FatImage::file_sector(sync_file) == 1 && FatImage::file_sector(async_file) == 1,
+        "test files are not in the second cluster");
+  
+  cache.clear();
+  device.blocks_read = 0;
+  device.prefetches  = 0;
+  auto ent = fs.stat(FatImage::file(sync_file));
+  CHECK(ent.is_valid(), "stat %s", FatImage::file(sync_file).c_str());
+  CHECK(device.blocks_read == 2, "sync stat read %zu blocks, expected 2", device.blocks_read);
+  CHECK(device.prefetches > 0, "sync stat gave the device no prefetch hints");
+  
+  cache.clear();
+  device.blocks_read = 0;
+  device.prefetches  = 0;
+  bool found = false;
+  fs.stat(FatImage::file(async_file),
+  [&found] (fs::error_t err, const FileSystem::Dirent& ent)
+  {
+    found = !err && ent.is_valid();
+  });
+  CHECK(found, "async stat %s", FatImage::file(async_file).c_str());
+  CHECK(device.blocks_read == 2, "async stat read %zu blocks, expected 2", device.blocks_read);
+  CHECK(device.prefetches > 0, "async stat gave the device no prefetch hints");
+  
+  printf("dir_prefetch: %d failures\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef TEST_FAT_IMAGE_HPP
+#define TEST_FAT_IMAGE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fs/mbr.hpp>
+#include <hw/disk_device.hpp>
+
+namespace test {
+
+#define CHECK(cond, ...)                                   \
+  do {                                                     \
+    if (!(cond)) {                                         \
+      printf("%s:%d: FAILED: ", __FILE__, __LINE__);       \
+      printf(__VA_ARGS__);                                 \
+      printf("\n");                                        \
+      failures++;                                          \
+    }                                                      \
+  } while (0)
+
+/**
+ *  FAT16 volume built in memory, 512-byte sectors and one sector
+ *  per cluster. The root directory holds DIR, a directory of
+ *  @dir_clusters contiguous clusters from cluster 2, with the empty
+ *  files FILE0000.TXT, FILE0001.TXT, ... after its dot entries.
+**/
+struct FatImage {
+  static const uint32_t SECTOR       = 512;
+  static const uint32_t CLUSTERS     = 5000;
+  static const uint32_t FAT_SECTORS  = ((CLUSTERS + 2) * 2 + SECTOR - 1) / SECTOR;
+  static const uint32_t ROOT_ENTRIES = 512;
+  static const uint32_t ROOT_SECTORS = ROOT_ENTRIES * 32 / SECTOR;
+  static const uint32_t ROOT_START   = 1 + FAT_SECTORS;
+  static const uint32_t DATA_START   = ROOT_START + ROOT_SECTORS;
+  static const uint32_t DIR_CLUSTER  = 2;
+  
+  std::vector<uint8_t> data;
+  
+  FatImage(uint32_t dir_clusters, uint32_t files)
+    : data((DATA_START + CLUSTERS) * SECTOR)
+  {
+    auto* mbr = (fs::MBR::mbr*) data.data();
+    memcpy(mbr->oem_name, "TESTFAT ", 8);
+    auto* bpb = mbr->bpb();
+    bpb->bytes_per_sector    = SECTOR;
+    bpb->sectors_per_cluster = 1;
+    bpb->reserved_sectors    = 1;
+    bpb->fa_tables           = 1;
+    bpb->root_entries        = ROOT_ENTRIES;
+    bpb->small_sectors       = DATA_START + CLUSTERS;
+    bpb->media_type          = 0xF8;
+    bpb->sectors_per_fat     = FAT_SECTORS;
+    bpb->signature           = 0x29;
+    memcpy(bpb->system_id, "FAT16   ", 8);
+    mbr->magic = 0xAA55;
+    
+    // the directory chain, with the reserved entries in front
+    fat_entry(0, 0xFFF8);
+    fat_entry(1, 0xFFFF);
+    for (uint32_t i = 0; i < dir_clusters; i++)
+        fat_entry(DIR_CLUSTER + i, (i + 1 < dir_clusters) ? DIR_CLUSTER + i + 1 : 0xFFFF);
+    
+    dir_entry(&data[ROOT_START * SECTOR], "DIR        ", 0x10, DIR_CLUSTER);
+    uint8_t* dir = &data[DATA_START * SECTOR];
+    dir_entry(dir,      ".          ", 0x10, DIR_CLUSTER);
+    dir_entry(dir + 32, "..         ", 0x10, 0);
+    for (uint32_t i = 0; i < files; i++)
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "FILE%04uTXT", i % 10000);
+      dir_entry(dir + (i + 2) * 32, name, 0x20, 0);
+    }
+  }
+  
+  // the path of file number @i, as the filesystem names it
+  static std::string file(uint32_t i)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "/DIR/FILE%04uTXT", i);
+    return name;
+  }
+  
+  // make the FAT entry of @cl point at @next
+  void link(uint32_t cl, uint16_t next)
+  { fat_entry(cl, next); }
+  
+  // the sector of DIR that the entry of file @i is in
+  static uint32_t file_sector(uint32_t i)
+  { return (i + 2) * 32 / SECTOR; }
+
+private:
+  void fat_entry(uint32_t cl, uint16_t value)
+  { memcpy(&data[SECTOR + cl * 2], &value, sizeof(value)); }
+  
+  static void dir_entry(uint8_t* ent, const char* name, uint8_t attrib, uint16_t cluster)
+  {
+    memcpy(ent, name, 11);
+    ent[11] = attrib;
+    memcpy(ent + 26, &cluster, sizeof(cluster));
+  }
+};
+
+/**
+ *  Synchronous device reading from a FatImage in memory, which
+ *  counts the blocks read and the prefetch hints it is given
+**/
+class ImageDisk : public hw::IDiskDevice {
+public:
+  ImageDisk(FatImage& img)
+    : image(img) {}
+  
+  size_t blocks_read = 0;
+  size_t prefetches  = 0;
+  
+  virtual const char* name() const noexcept override
+  { return "ImageDisk"; }
+  virtual block_t size() const noexcept override
+  { return image.data.size() / FatImage::SECTOR; }
+  virtual block_t block_size() const noexcept override
+  { return FatImage::SECTOR; }
+  
+  virtual void read(block_t blk, on_read_func reader) override
+  { reader(read_sync(blk, 1)); }
+  virtual void read(block_t blk, block_t count, on_read_func reader) override
+  { reader(read_sync(blk, count)); }
+  
+  virtual buffer_t read_sync(block_t blk) override
+  { return read_sync(blk, 1); }
+  virtual buffer_t read_sync(block_t blk, block_t count) override
+  {
+    if (blk + count > size()) return buffer_t();
+    blocks_read += count;
+    // the image outlives the filesystem, so lend out views of it
+    return buffer_t(&image.data[blk * FatImage::SECTOR], count * FatImage::SECTOR);
+  }
+  
+  virtual void prefetch(block_t, block_t) override
+  { prefetches++; }
+
+private:
+  FatImage& image;
+};
+
+} //< namespace test
+
+#endif //< TEST_FAT_IMAGE_HPP
@@ -0,0 +1,108 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Async path lookups keep their state in pooled path_op objects,
+// so each one makes a small, bounded number of heap allocations
+
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fs/disk.hpp>
+#include <fs/fat.hpp>
+
+#include "fat_image.hpp"
+
+using namespace fs;
+using test::FatImage;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+  allocations++;
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+void operator delete(void* ptr) noexcept
+{ free(ptr); }
+void operator delete(void* ptr, size_t) noexcept
+{ free(ptr); }
+
+// lookups per measurement
+static const uint32_t LOOKUPS = 100;
+// allocations allowed per lookup: parsing the path into its
+// components, and on a miss the entry cache insertions as well
+static const size_t WARM_MAX = 2;
+static const size_t MISS_MAX = 4;
+
+int main()
+{
+  int failures = 0;
+  
+  FatImage image(64, 900);
+  test::ImageDisk device(image);
+  
+  auto disk = std::make_shared<Disk<FAT>> (device);
+  bool mounted = false;
+  disk->mount(Disk<FAT>::MBR,
+  [&mounted] (fs::error_t err) { mounted = !err; });
+  CHECK(mounted, "mount");
+  if (!mounted) return EXIT_FAILURE;
+  auto& fs = disk->fs();
+  
+  uint32_t found = 0;
+  auto on_stat =
+  [&found] (fs::error_t err, const FileSystem::Dirent& ent)
+  {
+    found += !err && ent.is_valid();
+  };
+  // fill the path_op pool and cache the directory
+  fs.stat(FatImage::file(0), on_stat);
+  
+  // the same entry over and over
+  const std::string path = FatImage::file(1);
+  fs.stat(path, on_stat);
+  found = 0;
+  allocations = 0;
+  for (uint32_t i = 0; i < LOOKUPS; i++)
+      fs.stat(path, on_stat);
+  const size_t warm = allocations;
+  CHECK(found == LOOKUPS, "warm lookups found %u of %u", found, LOOKUPS);
+  CHECK(warm <= LOOKUPS * WARM_MAX,
+        "%zu allocations for %u warm lookups, at most %zu each", warm, LOOKUPS, WARM_MAX);
+  
+  // a different entry each time, scanning the directory
+  std::vector<std::string> paths;
+  for (uint32_t i = 0; i < LOOKUPS; i++)
+      paths.push_back(FatImage::file(100 + i));
+  found = 0;
+  allocations = 0;
+  for (const auto& p : paths)
+      fs.stat(p, on_stat);
+  const size_t miss = allocations;
+  CHECK(found == LOOKUPS, "missed lookups found %u of %u", found, LOOKUPS);
+  CHECK(miss <= LOOKUPS * MISS_MAX,
+        "%zu allocations for %u missed lookups, at most %zu each", miss, LOOKUPS, MISS_MAX);
+  
+  printf("lookup_allocs: %.2f allocations per warm lookup, %.2f per miss\n",
+         (double) warm / LOOKUPS, (double) miss / LOOKUPS);
+  printf("lookup_allocs: %d failures\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}